@@ -86,6 +86,8 @@
  * dpiValue -     The current dpi value.  Only 100 (color) and 200 (black/white)
  *                are allowed.
  *
+ * bytesRead -    How much the last bulkRead() actually read into largeBuffer.
+ *
  * largeBuffer -  Information that is read during a scan is kept in 
  *                largeBuffer.  When large amounts of memory are obtained and 
  *     	          released from the heap, errors occur.  This buffer prevents us 
@@ -96,6 +98,7 @@ static usb_dev_handle *deviceHandle = NULL;
 static int isDeviceOpen = 0;
 static int dpiValue = 100;
 static char largeBuffer[0xffff];
+static int bytesRead = 0;
 
 /* This holds information about what devices are opened
    Used in sane_get_devices()                           */
@@ -648,8 +651,7 @@ sane_read (SANE_Handle handle, SANE_Byte * buf, SANE_Int max_len,
     {
       /* Bulk read */
       result = bulkRead (typePtr + (i * 16));
-      dataAvailable =
-	(*(typePtr + (i * 16) + 2) << 8) + *(typePtr + (i * 16) + 3);
+      dataAvailable = bytesRead;
       whereInBuffer = 0;
     }
     else
@@ -902,26 +904,24 @@ int bulkRead (int *data)
 
   for (i = 0; i < 10000; ++i);
 
-  result = usb_bulk_read (deviceHandle, ep, buffer, size, 3000);
+  bytesRead = 0;
 
-  if (result > 0)
+  /* A short read is not the whole chunk, go back for the rest */
+  while (bytesRead < size)
   {
-    /* At least we've read something */
+    result = usb_bulk_read (deviceHandle, ep, buffer + bytesRead,
+			    size - bytesRead, 3000);
 
-    if (result == size)
-    {
-      return 1;
-    }
-    else
+    if (result <= 0)
     {
-      return 2;
+      /* Read failure, keep what we have */
+      return 0;
     }
+
+    bytesRead += result;
   }
-  else
-  {
-    /* Complete read failure */
-    return 0;
-  }
+
+  return 1;
 }
 
 
@@ -0,0 +1,108 @@
+/*******************************************************************************
+ *  arena.c
+ *
+ *  Purpose: Scan-lifetime memory.  See arena.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "arena.h"
+#include <stdlib.h>
+
+/* Enough for anything the engine keeps in an arena */
+#define ARENA_ALIGN 16
+
+
+
+
+/*******************************************************************************
+ *  Overflow -     Memory arenaAlloc() had to get from the heap, kept on a
+ *                 list so arenaDestroy() can give it back.
+ *
+ *  Arena -        data is the arena proper, used is how much of it has been
+ *                 handed out.
+ ******************************************************************************/
+typedef struct Overflow
+{
+  struct Overflow *next;
+  long pad;			/* Keeps what follows aligned */
+} Overflow;
+
+struct Arena
+{
+  char *data;
+  long size;
+  long used;
+  Overflow *overflow;
+  long overflows;
+};
+
+
+
+
+Arena *arenaCreate (long size)
+{
+  Arena *arena = calloc (1, sizeof (Arena));
+
+  if (arena == NULL)
+    return NULL;
+
+  arena->size = (size + ARENA_ALIGN - 1) & ~(long) (ARENA_ALIGN - 1);
+  arena->data = malloc (arena->size > 0 ? arena->size : 1);
+
+  if (arena->data == NULL)
+  {
+    free (arena);
+    return NULL;
+  }
+
+  return arena;
+}
+
+void *arenaAlloc (Arena *arena, long size)
+{
+  Overflow *overflow;
+  void *memory;
+
+  size = (size + ARENA_ALIGN - 1) & ~(long) (ARENA_ALIGN - 1);
+
+  if (arena->size - arena->used >= size)
+  {
+    memory = arena->data + arena->used;
+    arena->used += size;
+    return memory;
+  }
+
+  /* Too small.  Still works, but it shows */
+  overflow = malloc (sizeof (Overflow) + size);
+
+  if (overflow == NULL)
+    return NULL;
+
+  overflow->next = arena->overflow;
+  arena->overflow = overflow;
+  arena->overflows++;
+
+  return overflow + 1;
+}
+
+long arenaOverflows (Arena *arena)
+{
+  return arena->overflows;
+}
+
+void arenaDestroy (Arena *arena)
+{
+  Overflow *overflow;
+
+  while ((overflow = arena->overflow) != NULL)
+  {
+    arena->overflow = overflow->next;
+    free (overflow);
+  }
+
+  free (arena->data);
+  free (arena);
+}
@@ -0,0 +1,47 @@
+/*******************************************************************************
+ *  arena.h
+ *
+ *  Purpose: Memory for everything that lives as long as one scan.  The
+ *           size of the image is known from the parameters before the scan
+ *           starts, so what the scan needs can be taken from the heap in
+ *           one piece up front and handed back in one piece at the end.
+ *           Nothing in the read loop has to go to malloc() then.
+ *
+ *           If an arena was made too small it still hands out memory, from
+ *           the heap, and counts every time it had to.  That count is how a
+ *           scan shows it did not allocate while reading.
+ *
+ *           An arena is not locked; whoever shares one between threads
+ *           must.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef ARENA_H
+#define ARENA_H
+
+typedef struct Arena Arena;
+
+
+
+
+/*******************************************************************************
+ *  arenaCreate() -    An arena of size bytes, allocated now.  Returns NULL
+ *                     if there is not that much memory.
+ *
+ *  arenaAlloc() -     size bytes from the arena, aligned for any type.  The
+ *                     memory is not cleared.  Once the arena is used up it
+ *                     comes from the heap.
+ *
+ *  arenaOverflows() - How many times arenaAlloc() had to use the heap.
+ *
+ *  arenaDestroy() -   Frees the arena and everything taken from it.
+ ******************************************************************************/
+Arena *arenaCreate (long size);
+void *arenaAlloc (Arena *arena, long size);
+long arenaOverflows (Arena *arena);
+void arenaDestroy (Arena *arena);
+
+#endif
@@ -0,0 +1,189 @@
+/*******************************************************************************
+ *  bench.c
+ *
+ *  Purpose: Microbenchmarks for the loops that touch every byte of a scan,
+ *           so a change to one of them can be measured and a slowdown is
+ *           noticed.  'make bench' builds and runs it.
+ *
+ *           primabench [seconds] [name]
+ *
+ *           Each benchmark runs over buffers the size of one bulk read of
+ *           a scan (0x50c0 bytes), filled like the simulated scanner fills
+ *           them, for at least the given number of seconds (default 0.5).
+ *           It prints the image bytes handled per second.  With a name,
+ *           only the benchmarks whose name starts with it are run.
+ *
+ *           The SANE backend (SANE/primascan.c) is not built here; its
+ *           copy loop and text inversion are the same loops as
+ *           scannerRead() and the P4 writer, which are measured instead.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "scanner.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CHUNK_SIZE 0x50c0
+
+
+
+
+/*******************************************************************************
+ *  Benchmark -    name -     What is printed
+ *                 run -      Handles one chunk of CHUNK_SIZE bytes
+ *
+ *  chunk -        The input, as the scanner would send it
+ *  copy -         Where copies go
+ *  entry -        The input as a sequence table entry, for marshalling
+ *  devNull -      Where the output formats write, so only the formatting
+ *                 is measured
+ *  color, text -  The parameters of the two scan modes
+ ******************************************************************************/
+typedef struct Benchmark
+{
+  const char *name;
+  void (*run) (void);
+} Benchmark;
+
+static char chunk[CHUNK_SIZE];
+static char copy[CHUNK_SIZE];
+static int entry[CHUNK_SIZE];
+static FILE *devNull;
+static ScanParameters color;
+static ScanParameters text;
+
+
+
+
+/*******************************************************************************
+ *  The benchmarks, one chunk each.
+ *
+ *  seconds() -        Seconds between two times.
+ ******************************************************************************/
+static void copyData (void);
+static void marshal (void);
+static void asciiColor (void);
+static void asciiText (void);
+static void binaryText (void);
+static void binaryColor (void);
+static double seconds (struct timespec *from, struct timespec *to);
+
+static const Benchmark benchmarks[] = {
+  {"copy (scannerRead)", copyData},
+  {"marshal (controlTransfer)", marshal},
+  {"pnm-ascii P3 color", asciiColor},
+  {"pnm-ascii P2 text (bit expansion)", asciiText},
+  {"pnm P4 text (inversion)", binaryText},
+  {"pnm P6 color", binaryColor}
+};
+
+
+
+
+int main (int argc, char *argv[])
+{
+  double minimum = 0.5;
+  struct timespec start;
+  struct timespec now;
+  double elapsed;
+  long chunks;
+  int i;
+
+  if (argc > 1)
+    minimum = atof (argv[1]);
+
+  devNull = fopen ("/dev/null", "w");
+
+  if (devNull == NULL)
+  {
+    fprintf (stderr, "Could not open /dev/null\n");
+    return 1;
+  }
+
+  /* The pattern the simulated scanner sends */
+  for (i = 0; i < CHUNK_SIZE; i++)
+  {
+    chunk[i] = (char) (i / 7);
+    entry[i] = chunk[i] & 0xff;
+  }
+
+  color.format = SCAN_FORMAT_RGB;
+  text.format = SCAN_FORMAT_GRAY;
+
+  printf ("%-36s %14s %10s\n", "benchmark", "bytes/s", "ns/byte");
+
+  for (i = 0; i < sizeof (benchmarks) / sizeof (benchmarks[0]); i++)
+  {
+    if (argc > 2 && strncmp (benchmarks[i].name, argv[2], strlen (argv[2])))
+      continue;
+
+    /* Once to warm the caches, then for real */
+    benchmarks[i].run ();
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    chunks = 0;
+
+    do
+    {
+      benchmarks[i].run ();
+      chunks++;
+      clock_gettime (CLOCK_MONOTONIC, &now);
+    }
+    while ((elapsed = seconds (&start, &now)) < minimum);
+
+    printf ("%-36s %14.0f %10.3f\n", benchmarks[i].name,
+	    chunks * CHUNK_SIZE / elapsed,
+	    elapsed * 1e9 / (chunks * CHUNK_SIZE));
+  }
+
+  fclose (devNull);
+  return 0;
+}
+
+
+static void copyData (void)
+{
+  scannerCopyData (copy, chunk, CHUNK_SIZE);
+}
+
+
+static void marshal (void)
+{
+  scannerMarshal (copy, entry, CHUNK_SIZE);
+}
+
+
+static void asciiColor (void)
+{
+  outputData (devNull, OUTPUT_PNM_ASCII, &color, chunk, CHUNK_SIZE);
+}
+
+
+static void asciiText (void)
+{
+  outputData (devNull, OUTPUT_PNM_ASCII, &text, chunk, CHUNK_SIZE);
+}
+
+
+static void binaryText (void)
+{
+  outputData (devNull, OUTPUT_PNM, &text, chunk, CHUNK_SIZE);
+}
+
+
+static void binaryColor (void)
+{
+  outputData (devNull, OUTPUT_PNM, &color, chunk, CHUNK_SIZE);
+}
+
+
+static double seconds (struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
@@ -0,0 +1,235 @@
+#! /usr/bin/perl
+
+# benchmark regression gate for primabench and scanbench (make bench-gate)
+#
+#   ./benchgate.pl [--save] [--runs n] [--baseline file] [--alpha p]
+#                  [--threshold percent]
+#
+# runs the microbenchmarks and the simulated whole scans n times (default 5)
+# and compares every figure with the baseline kept for this machine, by
+# default baselines/<hostname>.json.  --save (or a missing baseline) stores
+# this run as the baseline instead.
+#
+# a figure has regressed when a one-sided Mann-Whitney test says the new
+# runs are worse than the baseline runs (p below alpha, default 0.01) and
+# the medians differ by more than the threshold (default 5 percent).  The
+# first keeps noise from failing the gate, the second keeps tiny but real
+# differences from failing it.  Exits 1 if anything regressed.
+#
+# baselines only make sense for the machine and build flags they came from.
+
+use strict;
+use warnings;
+use Getopt::Long;
+use JSON::PP;
+use Sys::Hostname;
+
+my $runs = 5;
+my $alpha = 0.01;
+my $threshold = 5;
+my $save = 0;
+my $host = hostname();
+$host =~ s/\..*//;
+my $baselineFile = "baselines/$host.json";
+
+GetOptions('runs=i' => \$runs, 'alpha=f' => \$alpha,
+           'threshold=f' => \$threshold, 'save' => \$save,
+           'baseline=s' => \$baselineFile)
+    or die "usage: $0 [--save] [--runs n] [--baseline file] [--alpha p] " .
+           "[--threshold percent]\n";
+
+die "$0: at least 2 runs are needed\n" if $runs < 2;
+
+my %current = measure($runs);
+
+if ($save || ! -e $baselineFile) {
+    mkdir 'baselines' if $baselineFile =~ m{^baselines/} && ! -d 'baselines';
+    open(my $out, '>', $baselineFile) or die "$baselineFile: $!\n";
+    print $out JSON::PP->new->pretty->canonical->encode({
+        machine => $host,
+        created => scalar(localtime),
+        runs => $runs,
+        metrics => \%current });
+    close($out);
+    print "baseline written to $baselineFile\n";
+    exit 0;
+}
+
+open(my $in, '<', $baselineFile) or die "$baselineFile: $!\n";
+my $baseline = decode_json(do { local $/; <$in> })->{metrics};
+close($in);
+
+# with too few runs even a clear regression can't get p below alpha
+my ($any) = values %$baseline;
+my $baselineRuns = $any ? @{$any->{samples}} : 0;
+my $smallestP = 1;
+$smallestP *= $_ / ($runs + $_) for 1 .. $baselineRuns;
+
+warn "warning: $runs runs against $baselineRuns can't get p below $alpha, " .
+     "use more runs\n" if $smallestP >= $alpha;
+
+my $regressions = 0;
+
+printf("%-48s %14s %14s %8s %8s\n", 'figure', 'baseline', 'now', 'change',
+       'p');
+
+foreach my $name (sort keys %current) {
+    my $old = $baseline->{$name};
+
+    if (!$old) {
+        printf("%-48s %14s %14.1f\n", $name, 'new',
+               median(@{$current{$name}{samples}}));
+        next;
+    }
+
+    my @before = @{$old->{samples}};
+    my @after = @{$current{$name}{samples}};
+    my $higherIsBetter = $current{$name}{better} eq 'higher';
+    my $medianBefore = median(@before);
+    my $medianAfter = median(@after);
+    my $change = $medianBefore ?
+        100 * ($medianAfter - $medianBefore) / $medianBefore : 0;
+
+    # p that the new runs are worse, i.e. lower (or higher) than before
+    my $p = $higherIsBetter ? mannWhitneyLess(\@after, \@before)
+                            : mannWhitneyLess(\@before, \@after);
+    my $worse = $higherIsBetter ? -$change : $change;
+    my $regressed = $p < $alpha && $worse > $threshold;
+
+    $regressions++ if $regressed;
+
+    printf("%-48s %14.1f %14.1f %+7.1f%% %8.4f%s\n", $name, $medianBefore,
+           $medianAfter, $change, $p, $regressed ? '  REGRESSED' : '');
+}
+
+print "\n", $regressions ? "$regressions figure(s) regressed\n"
+                         : "no regressions\n";
+exit($regressions ? 1 : 0);
+
+
+# every figure of runs runs, name => { better => higher|lower, samples => [] }
+sub measure {
+    my ($runs) = @_;
+    my %figures;
+
+    for (1 .. $runs) {
+        open(my $bench, '-|', './primabench', '0.2') or die "primabench: $!\n";
+        while (my $line = <$bench>) {
+            if ($line =~ /^(.+?)\s+(\d+)\s+[\d.]+$/) {
+                push(@{$figures{"micro/$1 bytes/s"}{samples}}, $2 + 0);
+                $figures{"micro/$1 bytes/s"}{better} = 'higher';
+            }
+        }
+        close($bench) or die "primabench failed\n";
+    }
+
+    open(my $scan, '-|', './scanbench', '-n', $runs) or die "scanbench: $!\n";
+    while (my $line = <$scan>) {
+        next unless $line =~ /^(\w+)\s+run/;
+        my $mode = $1;
+
+        while ($line =~ /(\w+)=([\d.]+)/g) {
+            next if $1 eq 'bytes';
+            push(@{$figures{"scan/$mode $1"}{samples}}, $2 + 0);
+            $figures{"scan/$mode $1"}{better} = 'lower';
+        }
+    }
+    close($scan) or die "scanbench failed\n";
+
+    return %figures;
+}
+
+
+sub median {
+    my @sorted = sort { $a <=> $b } @_;
+    my $middle = int(@sorted / 2);
+
+    return @sorted % 2 ? $sorted[$middle]
+                       : ($sorted[$middle - 1] + $sorted[$middle]) / 2;
+}
+
+
+# one-sided Mann-Whitney U test: p of seeing samples of x this much lower
+# than samples of y if both came from the same distribution
+sub mannWhitneyLess {
+    my ($x, $y) = @_;
+    my ($n, $m) = (scalar @$x, scalar @$y);
+
+    # U counts the pairs where x is greater, ties count half
+    my $u = 0;
+    my $ties = 0;
+    foreach my $xi (@$x) {
+        foreach my $yi (@$y) {
+            if ($xi > $yi) { $u += 1 }
+            elsif ($xi == $yi) { $u += 0.5; $ties++ }
+        }
+    }
+
+    # small samples without ties: the exact distribution of U
+    if (!$ties && $n <= 20 && $m <= 20) {
+        my @count = countU($n, $m);
+        my $total = 0;
+        my $below = 0;
+
+        for my $i (0 .. $#count) {
+            $total += $count[$i];
+            $below += $count[$i] if $i <= $u;
+        }
+
+        return $below / $total;
+    }
+
+    # otherwise the normal approximation with a tie correction
+    my @all = sort { $a <=> $b } (@$x, @$y);
+    my $correction = 0;
+    my $i = 0;
+    while ($i < @all) {
+        my $j = $i;
+        $j++ while $j + 1 < @all && $all[$j + 1] == $all[$i];
+        my $t = $j - $i + 1;
+        $correction += $t ** 3 - $t;
+        $i = $j + 1;
+    }
+
+    my $total = $n + $m;
+    my $variance = $n * $m / 12 *
+        (($total + 1) - $correction / ($total * ($total - 1)));
+
+    return 0.5 if $variance <= 0;
+
+    my $z = ($u - $n * $m / 2 + 0.5) / sqrt($variance);
+    return normalCdf($z);
+}
+
+
+# how many orderings of n and m samples give each value of U
+sub countU {
+    my ($n, $m) = @_;
+    my %table;
+
+    my $count;
+    $count = sub {
+        my ($n, $m, $u) = @_;
+        return 0 if $u < 0;
+        return $u == 0 ? 1 : 0 if $n == 0 || $m == 0;
+        my $key = "$n,$m,$u";
+        $table{$key} //=
+            $count->($n - 1, $m, $u - $m) + $count->($n, $m - 1, $u);
+        return $table{$key};
+    };
+
+    return map { $count->($n, $m, $_) } 0 .. $n * $m;
+}
+
+
+sub normalCdf {
+    my ($z) = @_;
+
+    # Abramowitz and Stegun 26.2.17
+    my $t = 1 / (1 + 0.2316419 * abs($z));
+    my $d = 0.3989422804014327 * exp(-$z * $z / 2);
+    my $p = $d * $t * (0.319381530 + $t * (-0.356563782 + $t * (1.781477937 +
+            $t * (-1.821255978 + $t * 1.330274429))));
+
+    return $z > 0 ? 1 - $p : $p;
+}
@@ -0,0 +1,113 @@
+#! /usr/bin/perl
+
+# classifies the IN control reads of the setup tables in primascan.h
+#
+#   ./deadreads.pl [--all] [--replay]
+#
+# every 0xc0 read of scannerSetup, setupBlack and setupColor is either
+#
+#   dead      - the next transfer writes the same register, and what it
+#               writes is the answer sniffusb recorded for the read.  The
+#               sniffed driver wrote back what was already there, the table
+#               holds that value and the engine throws what it reads away,
+#               so PRIMASCAN_SKIP_DEAD_READS=1 leaves these out (the rule is
+#               isDeadRead() in scanner.c)
+#   required  - anything else.  It may be a status read the scanner expects,
+#               or the driver changed what it read, which might have been
+#               different on another scanner, so it is kept
+#
+# prints how many of each there are per table, and with --all every read
+# with its register, the answer sniffusb recorded and the class.
+#
+# --replay scans with and without skipping on the simulated scanner with
+# usb timing and compares the images and how long the scans took.  That
+# shows the engine is fine without the reads.  The simulated scanner hands
+# every read back what the engine sent, so it cannot show that a read is
+# required; whether a real scanner is fine without them can only be found
+# out on one.
+
+use strict;
+use warnings;
+use Getopt::Long;
+
+my $all = 0;
+my $replay = 0;
+
+GetOptions('all' => \$all, 'replay' => \$replay)
+    or die "usage: $0 [--all] [--replay]\n";
+
+open(my $in, '<', 'primascan.h') or die "primascan.h: $!\n";
+my $source = do { local $/; <$in> };
+close($in);
+
+printf("%-14s %8s %6s %6s %9s\n", 'table', 'entries', 'reads', 'dead',
+       'required');
+
+foreach my $table ('scannerSetup', 'setupBlack', 'setupColor') {
+    my @entries = parseTable($table);
+    my ($reads, $dead) = (0, 0);
+
+    for my $i (0 .. $#entries) {
+        my $entry = $entries[$i];
+        next unless $entry->[0] == 0xc0 && $entry->[1] == 0x0c;
+
+        my $isDead = isDeadRead($entry, $entries[$i + 1]);
+        $reads++;
+        $dead++ if $isDead;
+
+        printf("  %-12s %4d  register 0x%02x  answer 0x%02x  %s\n", $table,
+               $i, $entry->[3], $entry->[8], $isDead ? 'dead' : 'required')
+            if $all;
+    }
+
+    printf("%-14s %8d %6d %6d %9d\n", $table, scalar @entries, $reads, $dead,
+           $reads - $dead);
+}
+
+exit 0 unless $replay;
+
+print "\n";
+local $ENV{PRIMASCAN_TRANSPORT} = 'sim';
+local $ENV{PRIMASCAN_SIM_TIMING} = $ENV{PRIMASCAN_SIM_TIMING} // 'usb';
+
+foreach my $mode ('color', 'text') {
+    my %image;
+
+    foreach my $skip (0, 1) {
+        local $ENV{PRIMASCAN_SKIP_DEAD_READS} = $skip;
+        my @args = $mode eq 'text' ? ('text') : ();
+        my $command = join(' ', './primascan', @args, '2>&1 >/dev/null');
+
+        # primascan prints the times on stderr, the image is checked apart
+        my $times = `$command`;
+        die "primascan failed\n" if $?;
+        $image{$skip} = `./primascan @args 2>/dev/null | md5sum`;
+
+        $times =~ /done after ([\d.]+) ms/ or die "no time from primascan\n";
+        printf("%-5s skip %d  %8.1f ms\n", $mode, $skip, $1);
+    }
+
+    print "$mode: the images differ\n" if $image{0} ne $image{1};
+}
+
+
+# the entries of table, each a reference to its numbers
+sub parseTable {
+    my ($table) = @_;
+
+    $source =~ /static int $table\[\d+\]\[\d+\] = \{(.*?)\n\};/s
+        or die "primascan.h: no $table\n";
+
+    return map { [ map { hex } /0x([0-9a-f]+)/g ] } $1 =~ /\{([^{}]*)\}/g;
+}
+
+
+# as in scanner.c: 0xc0 0x0c reads register [3] and was answered [8],
+# 0x40 0x04 writes register [8] with [9]
+sub isDeadRead {
+    my ($entry, $next) = @_;
+
+    return $next && $next->[0] == 0x40 && $next->[1] == 0x04 &&
+        $next->[4] == $entry->[4] && $next->[5] == $entry->[5] &&
+        $next->[8] == $entry->[3] && $next->[9] == $entry->[8];
+}
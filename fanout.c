@@ -0,0 +1,463 @@
+/*******************************************************************************
+ *  fanout.c
+ *
+ *  Purpose: Shares one scan between several subscriber threads.  See
+ *           fanout.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "fanout.h"
+#include "arena.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+
+/*******************************************************************************
+ *  RowBatch -     Some rows of the image.
+ *                 refs -     Subscribers that have not finished with it
+ *                 firstRow - Row number of the first row
+ *
+ *  Subscriber -   One consumer and the batches waiting for it.  queue is a
+ *                 ring as large as the pool, so it can never overflow.
+ *
+ *  Fanout -       The batches, their data and the subscriber queues all
+ *                 come from arena, allocated at once when the fan-out is
+ *                 made.
+ *                 allocations - Memory the last run had to allocate while
+ *                               reading, see fanoutAllocations()
+ *                 rows -     Rows published so far
+ *                 spooled -  Batches of rows in the spool, waiting for a
+ *                            free batch.  While there are any, the scanner
+ *                            reads into the spool too, so rows stay in order.
+ *                 scanned, status - The scanner thread is done, and how
+ *                            the scan ended
+ *
+ *  One lock and one condition cover everything.  There are only a handful
+ *  of threads and they wake up once per batch, not once per byte.  The
+ *  spool has its own.
+ ******************************************************************************/
+typedef struct RowBatch
+{
+  int refs;
+  int firstRow;
+  int rows;
+  char *data;
+  struct RowBatch *nextFree;
+} RowBatch;
+
+typedef struct Subscriber
+{
+  FanoutRows rows;
+  FanoutDone done;
+  void *user;
+
+  RowBatch **queue;
+  int head;
+  int count;
+
+  pthread_t thread;
+  struct Fanout *fanout;
+} Subscriber;
+
+struct Fanout
+{
+  ScanParameters params;
+  int rowsPerBatch;
+  int batchCount;
+
+  Arena *arena;
+  RowBatch *batches;
+  char *batchData;
+  RowBatch *freeList;
+
+  Subscriber subscribers[FANOUT_MAX_SUBSCRIBERS];
+  int subscriberCount;
+
+  Scanner *scanner;
+  Spool *spool;
+  long spoolLimit;
+  long spilled;
+  long allocations;
+
+  int rows;
+  int spooled;
+  int scanned;
+  int status;
+
+  int finished;
+  int failed;
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+
+
+
+/*******************************************************************************
+ *  subscriberThread() - Hands queued batches to one subscriber until the
+ *                     scan is finished.
+ *
+ *  scannerThread() -  Reads the whole scan, into free batches while there
+ *                     are any and into the spool while there are not.
+ *
+ *  publish() -        Numbers the rows of a filled batch and queues it for
+ *                     every subscriber.
+ ******************************************************************************/
+static void *subscriberThread (void *arg);
+static void *scannerThread (void *arg);
+static void publish (Fanout *fanout, RowBatch *batch);
+
+
+
+
+Fanout *fanoutCreate (ScanParameters *params, int rowsPerBatch,
+		      int batchCount, long spoolLimit)
+{
+  Fanout *fanout = calloc (1, sizeof (Fanout));
+  long batchBytes = (long) rowsPerBatch * params->bytesPerLine;
+  int i;
+
+  /* Room for the most subscribers there can be, so none allocate later */
+  fanout->arena = arenaCreate (batchCount * (sizeof (RowBatch) +
+					     batchBytes +
+					     FANOUT_MAX_SUBSCRIBERS *
+					     sizeof (RowBatch *)) +
+			       16 * (2 + FANOUT_MAX_SUBSCRIBERS));
+
+  if (fanout->arena == NULL)
+  {
+    free (fanout);
+    return NULL;
+  }
+
+  fanout->params = *params;
+  fanout->rowsPerBatch = rowsPerBatch;
+  fanout->batchCount = batchCount;
+  fanout->spoolLimit = spoolLimit;
+
+  /* All of the image memory in one piece */
+  fanout->batches = arenaAlloc (fanout->arena, batchCount * sizeof (RowBatch));
+  fanout->batchData = arenaAlloc (fanout->arena, batchCount * batchBytes);
+  memset (fanout->batches, 0, batchCount * sizeof (RowBatch));
+
+  for (i = 0; i < batchCount; i++)
+  {
+    fanout->batches[i].data = fanout->batchData + i * batchBytes;
+    fanout->batches[i].nextFree = fanout->freeList;
+    fanout->freeList = &fanout->batches[i];
+  }
+
+  pthread_mutex_init (&fanout->lock, NULL);
+  pthread_cond_init (&fanout->changed, NULL);
+
+  return fanout;
+}
+
+int fanoutSubscribe (Fanout *fanout, FanoutRows rows, FanoutDone done,
+		     void *user)
+{
+  Subscriber *subscriber;
+
+  if (fanout->subscriberCount == FANOUT_MAX_SUBSCRIBERS)
+    return 0;
+
+  subscriber = &fanout->subscribers[fanout->subscriberCount++];
+  subscriber->rows = rows;
+  subscriber->done = done;
+  subscriber->user = user;
+  subscriber->queue = arenaAlloc (fanout->arena,
+				  fanout->batchCount * sizeof (RowBatch *));
+  subscriber->fanout = fanout;
+
+  return 1;
+}
+
+int fanoutRun (Fanout *fanout, Scanner *scanner)
+{
+  int batchBytes = fanout->rowsPerBatch * fanout->params.bytesPerLine;
+  pthread_t reader;
+  int i;
+
+  fanout->scanner = scanner;
+  fanout->spool = spoolCreate (fanout->spoolLimit,
+			       (long) fanout->params.bytesPerLine *
+			       fanout->params.lines);
+
+  if (fanout->spool == NULL)
+    return SCANNER_ERROR;
+
+  pthread_create (&reader, NULL, scannerThread, fanout);
+
+  for (i = 0; i < fanout->subscriberCount; i++)
+    pthread_create (&fanout->subscribers[i].thread, NULL, subscriberThread,
+		    &fanout->subscribers[i]);
+
+  /* Batches that were spooled go out as subscribers free them up */
+  while (1)
+  {
+    RowBatch *batch;
+    int filled = 0;
+    int length;
+
+    pthread_mutex_lock (&fanout->lock);
+
+    while (fanout->spooled == 0 && !fanout->scanned)
+      pthread_cond_wait (&fanout->changed, &fanout->lock);
+
+    /* The spool is empty and the scanner is done with it */
+    if (fanout->spooled == 0)
+    {
+      pthread_mutex_unlock (&fanout->lock);
+      break;
+    }
+
+    /* Wait for a free batch.  This is where a slow subscriber holds us */
+    if (fanout->freeList == NULL && tracing)
+    {
+      struct timespec start;
+
+      traceNow (&start);
+
+      while (fanout->freeList == NULL)
+	pthread_cond_wait (&fanout->changed, &fanout->lock);
+
+      traceComplete ("wait", "wait for a free batch", &start, NULL);
+    }
+
+    while (fanout->freeList == NULL)
+      pthread_cond_wait (&fanout->changed, &fanout->lock);
+
+    batch = fanout->freeList;
+    fanout->freeList = batch->nextFree;
+
+    pthread_mutex_unlock (&fanout->lock);
+
+    /* Each spooled batch was committed whole, so this does not wait */
+    while (filled < batchBytes &&
+	   spoolRead (fanout->spool, batch->data + filled,
+		      batchBytes - filled, &length) == SCANNER_GOOD)
+      filled += length;
+
+    batch->rows = filled / fanout->params.bytesPerLine;
+    publish (fanout, batch);
+
+    pthread_mutex_lock (&fanout->lock);
+    fanout->spooled--;
+    pthread_cond_broadcast (&fanout->changed);
+    pthread_mutex_unlock (&fanout->lock);
+  }
+
+  /* Let the subscribers drain and finish */
+  pthread_join (reader, NULL);
+
+  pthread_mutex_lock (&fanout->lock);
+  fanout->finished = 1;
+  fanout->failed = (fanout->status != SCANNER_EOF);
+  pthread_cond_broadcast (&fanout->changed);
+  pthread_mutex_unlock (&fanout->lock);
+
+  for (i = 0; i < fanout->subscriberCount; i++)
+    pthread_join (fanout->subscribers[i].thread, NULL);
+
+  fanout->spilled = spoolSpilled (fanout->spool);
+  fanout->allocations = spoolAllocations (fanout->spool);
+  spoolDestroy (fanout->spool);
+  fanout->spool = NULL;
+
+  return fanout->failed ? SCANNER_ERROR : SCANNER_EOF;
+}
+
+long fanoutSpilled (Fanout *fanout)
+{
+  return fanout->spilled;
+}
+
+long fanoutAllocations (Fanout *fanout)
+{
+  return fanout->allocations + arenaOverflows (fanout->arena);
+}
+
+void fanoutDestroy (Fanout *fanout)
+{
+  pthread_mutex_destroy (&fanout->lock);
+  pthread_cond_destroy (&fanout->changed);
+
+  arenaDestroy (fanout->arena);
+  free (fanout);
+}
+
+
+static void *scannerThread (void *arg)
+{
+  Fanout *fanout = arg;
+  int batchBytes = fanout->rowsPerBatch * fanout->params.bytesPerLine;
+  int status = SCANNER_GOOD;
+
+  traceThreadName ("scanner reader");
+
+  /* Never waits for the subscribers, only for the scanner */
+  while (status == SCANNER_GOOD)
+  {
+    RowBatch *batch = NULL;
+    int filled = 0;
+    int length;
+    int size;
+    char *space;
+
+    /* Rows must stay in order, so nothing skips ahead of the spool */
+    pthread_mutex_lock (&fanout->lock);
+
+    if (fanout->spooled == 0 && fanout->freeList != NULL)
+    {
+      batch = fanout->freeList;
+      fanout->freeList = batch->nextFree;
+    }
+
+    pthread_mutex_unlock (&fanout->lock);
+
+    if (batch != NULL)
+    {
+      /* Read straight into it */
+      while (filled < batchBytes &&
+	     (status = scannerRead (fanout->scanner, batch->data + filled,
+				    batchBytes - filled, &length))
+	     == SCANNER_GOOD)
+	filled += length;
+
+      batch->rows = filled / fanout->params.bytesPerLine;
+      publish (fanout, batch);
+      continue;
+    }
+
+    /* They are all taken, so a batch of rows goes into the spool */
+    while (filled < batchBytes && status == SCANNER_GOOD)
+    {
+      space = spoolSpace (fanout->spool, &size);
+
+      if (size > batchBytes - filled)
+	size = batchBytes - filled;
+
+      status = scannerRead (fanout->scanner, space, size, &length);
+
+      if (status == SCANNER_GOOD && !spoolCommit (fanout->spool, length))
+	status = SCANNER_ERROR;
+      else if (status == SCANNER_GOOD)
+	filled += length;
+    }
+
+    if (filled > 0)
+    {
+      pthread_mutex_lock (&fanout->lock);
+      fanout->spooled++;
+      pthread_cond_broadcast (&fanout->changed);
+      pthread_mutex_unlock (&fanout->lock);
+    }
+  }
+
+  spoolFinish (fanout->spool, status != SCANNER_EOF);
+
+  pthread_mutex_lock (&fanout->lock);
+  fanout->scanned = 1;
+  fanout->status = status;
+  pthread_cond_broadcast (&fanout->changed);
+  pthread_mutex_unlock (&fanout->lock);
+
+  return NULL;
+}
+
+
+static void publish (Fanout *fanout, RowBatch *batch)
+{
+  int i;
+
+  pthread_mutex_lock (&fanout->lock);
+
+  /* Rows are numbered in the order their batches go out */
+  batch->firstRow = fanout->rows;
+  fanout->rows += batch->rows;
+  batch->refs = (batch->rows > 0) ? fanout->subscriberCount : 0;
+
+  for (i = 0; i < batch->refs; i++)
+  {
+    Subscriber *subscriber = &fanout->subscribers[i];
+    int tail = (subscriber->head + subscriber->count) % fanout->batchCount;
+
+    subscriber->queue[tail] = batch;
+    subscriber->count++;
+  }
+
+  /* Nobody to give it to, or nothing in it */
+  if (batch->refs == 0)
+  {
+    batch->nextFree = fanout->freeList;
+    fanout->freeList = batch;
+  }
+
+  pthread_cond_broadcast (&fanout->changed);
+  pthread_mutex_unlock (&fanout->lock);
+}
+
+
+static void *subscriberThread (void *arg)
+{
+  Subscriber *subscriber = arg;
+  Fanout *fanout = subscriber->fanout;
+  RowBatch *batch;
+  struct timespec start;
+
+  traceThreadName ("subscriber");
+
+  while (1)
+  {
+    pthread_mutex_lock (&fanout->lock);
+
+    if (tracing)
+      traceNow (&start);
+
+    while (subscriber->count == 0 && !fanout->finished)
+      pthread_cond_wait (&fanout->changed, &fanout->lock);
+
+    traceComplete ("wait", "wait for rows", &start, NULL);
+
+    /* Everything has been delivered */
+    if (subscriber->count == 0)
+    {
+      pthread_mutex_unlock (&fanout->lock);
+      break;
+    }
+
+    batch = subscriber->queue[subscriber->head];
+    subscriber->head = (subscriber->head + 1) % fanout->batchCount;
+    subscriber->count--;
+
+    pthread_mutex_unlock (&fanout->lock);
+
+    subscriber->rows (subscriber->user, &fanout->params, batch->firstRow,
+		      batch->data, batch->rows);
+
+    /* The last one to finish with a batch gives it back */
+    pthread_mutex_lock (&fanout->lock);
+
+    if (--batch->refs == 0)
+    {
+      batch->nextFree = fanout->freeList;
+      fanout->freeList = batch;
+      pthread_cond_broadcast (&fanout->changed);
+    }
+
+    pthread_mutex_unlock (&fanout->lock);
+  }
+
+  if (subscriber->done != NULL)
+    subscriber->done (subscriber->user, fanout->failed);
+
+  return NULL;
+}
@@ -0,0 +1,90 @@
+/*******************************************************************************
+ *  fanout.h
+ *
+ *  Purpose: Lets one scan feed several consumers at once, for example a
+ *           binary PNM for the archive, the raw bytes for OCR and a
+ *           thumbnail, without writing a file and reading it back for
+ *           each of them.
+ *
+ *           Image data is read from the scanner into row batches, each
+ *           holding a whole number of rows.  A batch is handed to every
+ *           subscriber as is; it is reference counted and goes back to the
+ *           pool when the last subscriber is finished with it.  Every
+ *           subscriber runs on its own thread.
+ *
+ *           There is a fixed number of batches, and the scanner is read
+ *           on a thread of its own straight into whichever is free.  When
+ *           a slow subscriber is holding all of them the scanner does not
+ *           wait: rows go into a spool (see spool.h), a batch at a time,
+ *           and are moved into batches as they come free.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "scanner.h"
+#include "spool.h"
+
+#define FANOUT_MAX_SUBSCRIBERS 8
+
+
+
+
+/*******************************************************************************
+ *  A subscriber is a pair of callbacks, both run on the subscriber's own
+ *  thread.
+ *
+ *  FanoutRows -   Called with each batch in order.  firstRow is the row
+ *                 number of the first row in data.  data must not be
+ *                 changed, other subscribers are reading it too.
+ *
+ *  FanoutDone -   Called once after the last batch.  failed is non-zero
+ *                 if the scan did not complete.
+ ******************************************************************************/
+typedef void (*FanoutRows) (void *user, ScanParameters *params,
+			    int firstRow, const char *data, int rows);
+typedef void (*FanoutDone) (void *user, int failed);
+
+typedef struct Fanout Fanout;
+
+
+
+
+/*******************************************************************************
+ *  fanoutCreate() -   A fan-out for an image described by params, with
+ *                     batchCount batches of rowsPerBatch rows each.  Up to
+ *                     spoolLimit bytes the batches cannot take yet are kept
+ *                     in memory, the rest are spilled to disk.  All the
+ *                     memory a run needs is allocated here and when it
+ *                     starts.  Returns NULL if there is not enough.
+ *
+ *  fanoutSubscribe() - Adds a subscriber.  Returns 0 if there are already
+ *                     FANOUT_MAX_SUBSCRIBERS.
+ *
+ *  fanoutRun() -      Starts the subscriber threads, reads the whole scan
+ *                     from the scanner and waits until every subscriber is
+ *                     done.  scannerStart() must already have been called.
+ *                     Returns SCANNER_EOF if the scan completed, otherwise
+ *                     SCANNER_ERROR.
+ *
+ *  fanoutSpilled() -  How many bytes of the last run were spilled to disk.
+ *
+ *  fanoutAllocations() - How many times memory had to be allocated after
+ *                     the last run had started.  Should be 0.
+ *
+ *  fanoutDestroy() -  Frees the fan-out and its batches.
+ ******************************************************************************/
+Fanout *fanoutCreate (ScanParameters *params, int rowsPerBatch,
+		      int batchCount, long spoolLimit);
+int fanoutSubscribe (Fanout *fanout, FanoutRows rows, FanoutDone done,
+		     void *user);
+int fanoutRun (Fanout *fanout, Scanner *scanner);
+long fanoutSpilled (Fanout *fanout);
+long fanoutAllocations (Fanout *fanout);
+void fanoutDestroy (Fanout *fanout);
+
+#endif
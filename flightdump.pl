@@ -0,0 +1,66 @@
+#! /usr/bin/perl
+
+# decoder for the flight recorder dumps written by primascan and primascand
+# (see flightrec.h for the format)
+#
+#   ./flightdump.pl /tmp/primascan-flight-<pid>-<device>.bin
+#
+# prints one line per transfer, oldest first: sequence number, time since the
+# first transfer in the dump, phase and table index, the transfer itself,
+# bytes asked for, result, duration and the first payload bytes.
+
+use strict;
+
+my @phases = ('open', 'initialize', 'setup', 'calibration', 'scan',
+              'finalize', 'recover');
+my @kinds = ('control', 'bulk-in', 'bulk-out', 'clear-halt', 'reset');
+
+my $file = shift or die "usage: $0 dumpfile\n";
+open(my $in, '<', $file) or die "$file: $!\n";
+binmode($in);
+
+my $header;
+read($in, $header, 24) == 24 or die "$file: too short\n";
+
+my ($magic, $version, $entrySize, $count, $device) =
+    unpack('a8 V V V l<', $header);
+
+die "$file: not a flight recorder dump\n" if $magic ne 'PSFLIGHT';
+die "$file: version $version, only 1 is known\n" if $version != 1;
+
+print "device $device, $count transfers\n\n";
+
+my $first;
+my $entry;
+
+while ($count-- > 0 && read($in, $entry, $entrySize) == $entrySize) {
+
+    my ($sequence, $phase, $kind, $tableIndex, $requestType, $request,
+        $value, $index, $reserved, $size, $result, $startNs, $durationUs,
+        $payload) = unpack('V C C v C C v v v l< l< Q< V a28', $entry);
+
+    $first = $startNs unless defined $first;
+
+    my $what;
+    if ($kind == 0) {
+        $what = sprintf("%02x %02x %04x %04x", $requestType, $request,
+                        $value, $index);
+    }
+    else {
+        $what = sprintf("ep %02x", $index);
+    }
+
+    # only as many payload bytes as were transferred
+    my $shown = ($result >= 0 && $result < $size) ? $result : $size;
+    $shown = 28 if $shown > 28;
+    $shown = 0 if $shown < 0 || $kind > 2;
+
+    # a failed read brought nothing back
+    $shown = 0 if $result < 0 && ($kind == 1 || ($kind == 0 && $requestType & 0x80));
+
+    printf("%8d %10.3f ms  %-11s %4d  %-10s %-16s size %-5d result %-6d %7d us  %s\n",
+           $sequence, ($startNs - $first) / 1000000,
+           $phases[$phase] // $phase, $tableIndex, $kinds[$kind] // $kind,
+           $what, $size, $result, $durationUs,
+           unpack('H*', substr($payload, 0, $shown)));
+}
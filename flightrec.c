@@ -0,0 +1,144 @@
+/*******************************************************************************
+ *  flightrec.c
+ *
+ *  Purpose: The flight recorder for USB transfers.  See flightrec.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "flightrec.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+
+/*******************************************************************************
+ *  writeAll() -       write() until everything is out.  Returns 0 on error.
+ ******************************************************************************/
+static int writeAll (int fd, const void *data, long length);
+
+
+
+
+void flightInit (FlightRecorder *recorder, int device)
+{
+  const char *directory = getenv ("TMPDIR");
+
+  if (directory == NULL || directory[0] == '\0')
+    directory = "/tmp";
+
+  memset (recorder, 0, sizeof (FlightRecorder));
+  recorder->device = device;
+
+  snprintf (recorder->path, sizeof (recorder->path),
+	    "%s/primascan-flight-%d-%d.bin", directory, (int) getpid (),
+	    device);
+}
+
+void flightRecord (FlightRecorder *recorder, int kind, int requestType,
+		   int request, int value, int index, const char *buffer,
+		   int size, int result, struct timespec *start)
+{
+  FlightEntry *entry;
+  struct timespec now;
+  int copy;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  entry = &recorder->entries[recorder->count % FLIGHT_ENTRIES];
+  entry->sequence = recorder->count;
+  entry->phase = recorder->phase;
+  entry->kind = kind;
+  entry->tableIndex = recorder->tableIndex;
+  entry->requestType = requestType;
+  entry->request = request;
+  entry->value = value;
+  entry->index = index;
+  entry->size = size;
+  entry->result = result;
+  entry->startNs = start->tv_sec * 1000000000ULL + start->tv_nsec;
+  entry->durationUs = ((now.tv_sec - start->tv_sec) * 1000000000LL +
+		       (now.tv_nsec - start->tv_nsec)) / 1000;
+
+  /* Only what was actually transferred */
+  copy = (result >= 0 && result < size) ? result : size;
+
+  if (copy > FLIGHT_PAYLOAD)
+    copy = FLIGHT_PAYLOAD;
+
+  if (buffer == NULL || copy < 0)
+    copy = 0;
+
+  memcpy (entry->payload, buffer, copy);
+  memset (entry->payload + copy, 0, FLIGHT_PAYLOAD - copy);
+
+  recorder->count++;
+}
+
+int flightDump (FlightRecorder *recorder)
+{
+  FlightFileHeader header;
+  uint32_t count = recorder->count;
+  uint32_t first;
+  int fd;
+  int ok;
+
+  fd = open (recorder->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd < 0)
+    return 0;
+
+  memcpy (header.magic, FLIGHT_MAGIC, sizeof (header.magic));
+  header.version = FLIGHT_VERSION;
+  header.entrySize = sizeof (FlightEntry);
+  header.count = count < FLIGHT_ENTRIES ? count : FLIGHT_ENTRIES;
+  header.device = recorder->device;
+
+  /* Oldest first, which is two pieces once the ring has wrapped */
+  first = count - header.count;
+
+  ok = writeAll (fd, &header, sizeof (header));
+
+  if (first % FLIGHT_ENTRIES + header.count > FLIGHT_ENTRIES)
+  {
+    ok = ok && writeAll (fd, &recorder->entries[first % FLIGHT_ENTRIES],
+			 (FLIGHT_ENTRIES - first % FLIGHT_ENTRIES) *
+			 sizeof (FlightEntry));
+    ok = ok && writeAll (fd, recorder->entries, (count % FLIGHT_ENTRIES) *
+			 sizeof (FlightEntry));
+  }
+  else
+  {
+    ok = ok && writeAll (fd, &recorder->entries[first % FLIGHT_ENTRIES],
+			 header.count * sizeof (FlightEntry));
+  }
+
+  close (fd);
+  return ok;
+}
+
+
+static int writeAll (int fd, const void *data, long length)
+{
+  const char *from = data;
+  long result;
+
+  while (length > 0)
+  {
+    result = write (fd, from, length);
+
+    if (result <= 0)
+      return 0;
+
+    from += result;
+    length -= result;
+  }
+
+  return 1;
+}
@@ -0,0 +1,150 @@
+/*******************************************************************************
+ *  flightrec.h
+ *
+ *  Purpose: A flight recorder for the USB traffic of one scanner.  Every
+ *           transfer the engine makes is written into a ring of the last
+ *           FLIGHT_ENTRIES transfers, which costs two clock reads and a
+ *           small copy, so it is always on.  When something goes wrong the
+ *           ring is dumped to a file, and flightdump.pl turns the file
+ *           into something a person can read.
+ *
+ *           The ring is dumped when a transfer fails for good (in any
+ *           phase, finalize included), when a scanner cannot be
+ *           recovered, on SIGUSR1 and (in primascand) on the "dump"
+ *           request.  The file is
+ *
+ *               $TMPDIR/primascan-flight-<pid>-<device>.bin
+ *
+ *           (/tmp if TMPDIR is not set) and is replaced by every dump.
+ *
+ *  File format (little endian, as written by the machine that scanned):
+ *
+ *           FlightFileHeader, then count FlightEntry records, oldest
+ *           first.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef FLIGHTREC_H
+#define FLIGHTREC_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define FLIGHT_ENTRIES 256
+#define FLIGHT_PAYLOAD 28
+
+#define FLIGHT_MAGIC   "PSFLIGHT"
+#define FLIGHT_VERSION 1
+
+
+
+
+/*******************************************************************************
+ *  Phases, the part of the sequence a transfer belonged to
+ ******************************************************************************/
+#define FLIGHT_PHASE_OPEN        0
+#define FLIGHT_PHASE_INITIALIZE  1
+#define FLIGHT_PHASE_SETUP       2
+#define FLIGHT_PHASE_CALIBRATION 3
+#define FLIGHT_PHASE_SCAN        4
+#define FLIGHT_PHASE_FINALIZE    5
+#define FLIGHT_PHASE_RECOVER     6
+
+/*******************************************************************************
+ *  Kinds of transfer
+ ******************************************************************************/
+#define FLIGHT_CONTROL    0
+#define FLIGHT_BULK_IN    1
+#define FLIGHT_BULK_OUT   2
+#define FLIGHT_CLEAR_HALT 3
+#define FLIGHT_RESET      4
+
+
+
+
+/*******************************************************************************
+ *  FlightEntry -  One transfer, 64 bytes.
+ *
+ *  sequence -     Counts every transfer since the scanner was opened
+ *  phase, tableIndex - Where in the sequence tables it came from
+ *  requestType, request, value, index - The setup packet (control), or the
+ *                 endpoint in index (bulk)
+ *  size -         Bytes asked for
+ *  result -       What the transport returned
+ *  startNs -      CLOCK_MONOTONIC when it started
+ *  durationUs -   How long it took
+ *  payload -      The first bytes of the buffer after the transfer
+ *
+ *  FlightFileHeader - FLIGHT_MAGIC, FLIGHT_VERSION, sizeof (FlightEntry),
+ *                 how many entries follow, and which scanner they are for.
+ ******************************************************************************/
+typedef struct FlightEntry
+{
+  uint32_t sequence;
+  uint8_t phase;
+  uint8_t kind;
+  uint16_t tableIndex;
+  uint8_t requestType;
+  uint8_t request;
+  uint16_t value;
+  uint16_t index;
+  uint16_t reserved;
+  int32_t size;
+  int32_t result;
+  uint64_t startNs;
+  uint32_t durationUs;
+  uint8_t payload[FLIGHT_PAYLOAD];
+} FlightEntry;
+
+typedef struct FlightFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t entrySize;
+  uint32_t count;
+  int32_t device;
+} FlightFileHeader;
+
+
+
+
+/*******************************************************************************
+ *  FlightRecorder - The ring itself.
+ *
+ *  count -        Transfers recorded so far; the newest is in
+ *                 entries[(count - 1) % FLIGHT_ENTRIES]
+ *  phase, tableIndex - Set by the engine before each transfer
+ *  path -         Where dumps go, worked out in advance so dumping from a
+ *                 signal handler needs nothing but open() and write()
+ ******************************************************************************/
+typedef struct FlightRecorder
+{
+  FlightEntry entries[FLIGHT_ENTRIES];
+  uint32_t count;
+  int device;
+  int phase;
+  int tableIndex;
+  char path[128];
+} FlightRecorder;
+
+
+
+
+/*******************************************************************************
+ *  flightInit() -     Empties the recorder for the given scanner.
+ *
+ *  flightRecord() -   Adds a transfer that started at start.
+ *
+ *  flightDump() -     Writes the ring to recorder->path.  Safe to call from
+ *                     a signal handler.  Returns 1 on success.
+ ******************************************************************************/
+void flightInit (FlightRecorder *recorder, int device);
+void flightRecord (FlightRecorder *recorder, int kind, int requestType,
+		   int request, int value, int index, const char *buffer,
+		   int size, int result, struct timespec *start);
+int flightDump (FlightRecorder *recorder);
+
+#endif
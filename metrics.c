@@ -0,0 +1,396 @@
+/*******************************************************************************
+ *  metrics.c
+ *
+ *  Purpose: Counters and histograms in the Prometheus text format.  See
+ *           metrics.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "metrics.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+
+
+
+/*******************************************************************************
+ *  secondBounds, throughputBounds - Bucket bounds for latencies (seconds)
+ *                 and for throughput (bytes per second).
+ *
+ *  registered -   Every Metrics being reported.  The lock only guards the
+ *                 list; the counters themselves are never locked.
+ *
+ *  phaseNames -   Labels for phaseSeconds, by FLIGHT_PHASE_*.  Phases
+ *                 without a name are not timed.
+ *
+ *  Counter -      A counter metric and where it is kept in Metrics.
+ ******************************************************************************/
+static const double secondBounds[METRICS_BUCKETS] = {
+  0.001, 0.005, 0.01, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30
+};
+
+static const double throughputBounds[METRICS_BUCKETS] = {
+  65536, 131072, 262144, 524288, 1048576, 2097152, 4194304, 8388608,
+  16777216, 33554432, 67108864, 134217728
+};
+
+static Metrics *registered = NULL;
+static pthread_mutex_t registeredLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *phaseNames[METRICS_PHASES] = {
+  NULL, "initialize", "setup", "calibration", "scan", "finalize", NULL
+};
+
+static const char *transferKinds[METRICS_TRANSFER_KINDS] = {
+  "control", "bulk_in", "bulk_out"
+};
+
+static const char *recoveryLevels[METRICS_RECOVERY_LEVELS] = {
+  NULL, "clear_halt", "repoll", "finalize", "reset"
+};
+
+typedef struct Counter
+{
+  const char *name;
+  const char *help;
+  size_t offset;
+} Counter;
+
+static const Counter counters[] = {
+  {"primascan_scans_total", "Scan jobs that completed.",
+   offsetof (Metrics, scans)},
+  {"primascan_failed_scans_total", "Scan jobs that failed.",
+   offsetof (Metrics, failedScans)},
+  {"primascan_pages_total", "Pages scanned.",
+   offsetof (Metrics, pages)},
+  {"primascan_bytes_total", "Image bytes delivered.",
+   offsetof (Metrics, bytes)},
+  {"primascan_restarts_total", "Scan jobs started over after a failure.",
+   offsetof (Metrics, restarts)},
+  {"primascan_transfer_errors_total", "USB transfers that failed.",
+   offsetof (Metrics, transferErrors)},
+  {"primascan_transfer_retries_total",
+   "USB transfers tried again while recovering.",
+   offsetof (Metrics, transferRetries)},
+  {"primascan_polls_total", "Status reads waiting for the scanner.",
+   offsetof (Metrics, polls)},
+  {"primascan_unrecovered_total", "Failures the scanner was not recovered "
+   "from.", offsetof (Metrics, unrecovered)}
+};
+
+
+
+
+/*******************************************************************************
+ *  load() -           Reads a counter another thread may be writing.
+ *
+ *  isFirst() -        Whether metrics is the first registered for its
+ *                     device.  A device with several is written out once,
+ *                     when its first one comes up.
+ *
+ *  sumHistograms() -  Adds up one histogram of every registered Metrics of
+ *                     a device.  Called with the list locked.
+ *
+ *  writeHistogram() - Writes one histogram series.
+ ******************************************************************************/
+static unsigned long load (const unsigned long *counter);
+static int isFirst (Metrics *metrics);
+static void sumHistograms (int device, size_t offset,
+			   MetricsHistogram *total);
+static void writeHistogram (FILE *out, const char *name, const char *labels,
+			    MetricsHistogram *histogram);
+
+
+
+
+void metricsInit (Metrics *metrics, int device)
+{
+  int i;
+
+  memset (metrics, 0, sizeof (Metrics));
+  metrics->device = device;
+
+  for (i = 0; i < METRICS_PHASES; i++)
+    metrics->phaseSeconds[i].bounds = secondBounds;
+
+  metrics->scanSeconds.bounds = secondBounds;
+  metrics->firstByteSeconds.bounds = secondBounds;
+  metrics->throughput.bounds = throughputBounds;
+}
+
+void metricsRegister (Metrics *metrics)
+{
+  pthread_mutex_lock (&registeredLock);
+  metrics->next = registered;
+  registered = metrics;
+  pthread_mutex_unlock (&registeredLock);
+}
+
+void metricsCount (unsigned long *counter, unsigned long n)
+{
+  /* There is only one writer, so a plain add is enough; the store just
+   * must not tear for a reader */
+  __atomic_store_n (counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+void metricsObserve (MetricsHistogram *histogram, double value)
+{
+  double sum = histogram->sum + value;
+  int i;
+
+  for (i = 0; i < METRICS_BUCKETS && value > histogram->bounds[i]; i++)
+    ;
+
+  metricsCount (&histogram->buckets[i], 1);
+  __atomic_store (&histogram->sum, &sum, __ATOMIC_RELAXED);
+}
+
+void metricsWrite (FILE *out)
+{
+  MetricsHistogram total;
+  Metrics *metrics;
+  Metrics *other;
+  unsigned long value;
+  char labels[64];
+  size_t i;
+  int j;
+
+  pthread_mutex_lock (&registeredLock);
+
+  /* Counters, one series per device */
+  for (i = 0; i < sizeof (counters) / sizeof (counters[0]); i++)
+  {
+    fprintf (out, "# HELP %s %s\n# TYPE %s counter\n", counters[i].name,
+	     counters[i].help, counters[i].name);
+
+    for (metrics = registered; metrics; metrics = metrics->next)
+    {
+      if (!isFirst (metrics))
+	continue;
+
+      for (value = 0, other = registered; other; other = other->next)
+      {
+	if (other->device == metrics->device)
+	  value += load ((unsigned long *) ((char *) other +
+					    counters[i].offset));
+      }
+
+      fprintf (out, "%s{device=\"%d\"} %lu\n", counters[i].name,
+	       metrics->device, value);
+    }
+  }
+
+  /* Counters with a second label */
+  fprintf (out, "# HELP primascan_transfers_total USB transfers.\n"
+	   "# TYPE primascan_transfers_total counter\n");
+
+  for (metrics = registered; metrics; metrics = metrics->next)
+  {
+    if (!isFirst (metrics))
+      continue;
+
+    for (j = 0; j < METRICS_TRANSFER_KINDS; j++)
+    {
+      for (value = 0, other = registered; other; other = other->next)
+      {
+	if (other->device == metrics->device)
+	  value += load (&other->transfers[j]);
+      }
+
+      fprintf (out, "primascan_transfers_total{device=\"%d\",kind=\"%s\"} "
+	       "%lu\n", metrics->device, transferKinds[j], value);
+    }
+  }
+
+  fprintf (out, "# HELP primascan_recoveries_total Failures the scanner "
+	   "was recovered from, by the step that did it.\n"
+	   "# TYPE primascan_recoveries_total counter\n");
+
+  for (metrics = registered; metrics; metrics = metrics->next)
+  {
+    if (!isFirst (metrics))
+      continue;
+
+    for (j = 1; j < METRICS_RECOVERY_LEVELS; j++)
+    {
+      for (value = 0, other = registered; other; other = other->next)
+      {
+	if (other->device == metrics->device)
+	  value += load (&other->recoveries[j]);
+      }
+
+      fprintf (out, "primascan_recoveries_total{device=\"%d\",level=\"%s\"} "
+	       "%lu\n", metrics->device, recoveryLevels[j], value);
+    }
+  }
+
+  /* Histograms */
+  fprintf (out, "# HELP primascan_phase_seconds How long each phase of a "
+	   "scan took.\n# TYPE primascan_phase_seconds histogram\n");
+
+  for (metrics = registered; metrics; metrics = metrics->next)
+  {
+    if (!isFirst (metrics))
+      continue;
+
+    for (j = 0; j < METRICS_PHASES; j++)
+    {
+      if (phaseNames[j] == NULL)
+	continue;
+
+      sumHistograms (metrics->device, offsetof (Metrics, phaseSeconds) +
+		     j * sizeof (MetricsHistogram), &total);
+      snprintf (labels, sizeof (labels), "device=\"%d\",phase=\"%s\"",
+		metrics->device, phaseNames[j]);
+      writeHistogram (out, "primascan_phase_seconds", labels, &total);
+    }
+  }
+
+  fprintf (out, "# HELP primascan_scan_seconds From a job arriving to its "
+	   "last byte out.\n# TYPE primascan_scan_seconds histogram\n");
+
+  for (metrics = registered; metrics; metrics = metrics->next)
+  {
+    if (!isFirst (metrics))
+      continue;
+
+    sumHistograms (metrics->device, offsetof (Metrics, scanSeconds), &total);
+    snprintf (labels, sizeof (labels), "device=\"%d\"", metrics->device);
+    writeHistogram (out, "primascan_scan_seconds", labels, &total);
+  }
+
+  fprintf (out, "# HELP primascan_first_byte_seconds From a job arriving "
+	   "to its first byte out.\n"
+	   "# TYPE primascan_first_byte_seconds histogram\n");
+
+  for (metrics = registered; metrics; metrics = metrics->next)
+  {
+    if (!isFirst (metrics))
+      continue;
+
+    sumHistograms (metrics->device, offsetof (Metrics, firstByteSeconds),
+		   &total);
+    snprintf (labels, sizeof (labels), "device=\"%d\"", metrics->device);
+    writeHistogram (out, "primascan_first_byte_seconds", labels, &total);
+  }
+
+  fprintf (out, "# HELP primascan_throughput_bytes_per_second Image bytes "
+	   "per second of each scan.\n"
+	   "# TYPE primascan_throughput_bytes_per_second histogram\n");
+
+  for (metrics = registered; metrics; metrics = metrics->next)
+  {
+    if (!isFirst (metrics))
+      continue;
+
+    sumHistograms (metrics->device, offsetof (Metrics, throughput), &total);
+    snprintf (labels, sizeof (labels), "device=\"%d\"", metrics->device);
+    writeHistogram (out, "primascan_throughput_bytes_per_second", labels,
+		    &total);
+  }
+
+  pthread_mutex_unlock (&registeredLock);
+}
+
+int metricsWriteFile (const char *path, const char *extra)
+{
+  static pthread_mutex_t fileLock = PTHREAD_MUTEX_INITIALIZER;
+  char temporary[256];
+  FILE *out;
+  int ok;
+
+  snprintf (temporary, sizeof (temporary), "%s.tmp", path);
+
+  /* Two threads must not write the same temporary file */
+  pthread_mutex_lock (&fileLock);
+
+  out = fopen (temporary, "w");
+
+  if (out == NULL)
+  {
+    pthread_mutex_unlock (&fileLock);
+    return 0;
+  }
+
+  metricsWrite (out);
+
+  if (extra != NULL)
+    fputs (extra, out);
+
+  ok = !ferror (out);
+  ok = !fclose (out) && ok && !rename (temporary, path);
+
+  pthread_mutex_unlock (&fileLock);
+  return ok;
+}
+
+
+static unsigned long load (const unsigned long *counter)
+{
+  return __atomic_load_n (counter, __ATOMIC_RELAXED);
+}
+
+
+static int isFirst (Metrics *metrics)
+{
+  Metrics *other;
+
+  for (other = registered; other->device != metrics->device;
+       other = other->next)
+    ;
+
+  return other == metrics;
+}
+
+
+static void sumHistograms (int device, size_t offset,
+			   MetricsHistogram *total)
+{
+  MetricsHistogram *histogram;
+  Metrics *metrics;
+  double sum;
+  int i;
+
+  memset (total, 0, sizeof (MetricsHistogram));
+
+  for (metrics = registered; metrics; metrics = metrics->next)
+  {
+    if (metrics->device != device)
+      continue;
+
+    histogram = (MetricsHistogram *) ((char *) metrics + offset);
+    total->bounds = histogram->bounds;
+
+    for (i = 0; i <= METRICS_BUCKETS; i++)
+      total->buckets[i] += load (&histogram->buckets[i]);
+
+    __atomic_load (&histogram->sum, &sum, __ATOMIC_RELAXED);
+    total->sum += sum;
+  }
+}
+
+
+static void writeHistogram (FILE *out, const char *name, const char *labels,
+			    MetricsHistogram *histogram)
+{
+  unsigned long cumulative = 0;
+  int i;
+
+  for (i = 0; i < METRICS_BUCKETS; i++)
+  {
+    cumulative += histogram->buckets[i];
+    fprintf (out, "%s_bucket{%s,le=\"%g\"} %lu\n", name, labels,
+	     histogram->bounds[i], cumulative);
+  }
+
+  /* _count is the +Inf bucket, so the two always agree in one scrape */
+  cumulative += histogram->buckets[METRICS_BUCKETS];
+  fprintf (out, "%s_bucket{%s,le=\"+Inf\"} %lu\n", name, labels, cumulative);
+  fprintf (out, "%s_sum{%s} %g\n", name, labels, histogram->sum);
+  fprintf (out, "%s_count{%s} %lu\n", name, labels, cumulative);
+}
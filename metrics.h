@@ -0,0 +1,121 @@
+/*******************************************************************************
+ *  metrics.h
+ *
+ *  Purpose: Counters and histograms for monitoring a fleet of scanners,
+ *           written out in the Prometheus text format.
+ *
+ *           Every Scanner carries its own Metrics, and only the thread
+ *           driving that scanner ever writes to them.  So recording is a
+ *           plain store with no lock and no atomic read-modify-write, and
+ *           the USB loop never waits on anybody.  Whoever scrapes reads
+ *           every registered Metrics and adds them up per device.
+ *
+ *           primascand serves them on a local HTTP port (-p) and can keep
+ *           a file up to date for node_exporter's textfile collector (-t).
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+#define METRICS_BUCKETS 12
+
+/* Phases are numbered as in flightrec.h, recovery levels as in scanner.h */
+#define METRICS_PHASES          7
+#define METRICS_RECOVERY_LEVELS 5
+#define METRICS_TRANSFER_KINDS  3
+
+
+
+
+/*******************************************************************************
+ *  MetricsHistogram - Observations counted into METRICS_BUCKETS buckets
+ *                 with the upper bounds in bounds, plus one for anything
+ *                 larger.  Buckets are kept per bucket, not cumulative;
+ *                 that is worked out when they are written.
+ *
+ *  Metrics -      Everything recorded for one scanner.
+ *                 device -         The label it is exported under
+ *                 next -           The next registered Metrics
+ *                 scans, failedScans, pages, bytes - Jobs finished,
+ *                                  jobs that failed, pages and image bytes
+ *                                  delivered
+ *                 restarts -       Times a job was started again
+ *                 transfers -      USB transfers by FLIGHT_CONTROL,
+ *                                  FLIGHT_BULK_IN and FLIGHT_BULK_OUT
+ *                 transferErrors - Transfers that failed outright
+ *                 transferRetries - Transfers tried again while recovering
+ *                 polls -          Status reads while waiting for the
+ *                                  scanner to be ready
+ *                 recoveries, unrecovered - As in Scanner
+ *                 phaseSeconds -   How long each phase of a scan took
+ *                 scanSeconds, firstByteSeconds - From the job arriving to
+ *                                  the last and to the first byte out
+ *                 throughput -     Image bytes per second of each scan
+ ******************************************************************************/
+typedef struct MetricsHistogram
+{
+  const double *bounds;
+  unsigned long buckets[METRICS_BUCKETS + 1];
+  double sum;
+} MetricsHistogram;
+
+typedef struct Metrics
+{
+  int device;
+  struct Metrics *next;
+
+  unsigned long scans;
+  unsigned long failedScans;
+  unsigned long pages;
+  unsigned long bytes;
+  unsigned long restarts;
+
+  unsigned long transfers[METRICS_TRANSFER_KINDS];
+  unsigned long transferErrors;
+  unsigned long transferRetries;
+  unsigned long polls;
+  unsigned long recoveries[METRICS_RECOVERY_LEVELS];
+  unsigned long unrecovered;
+
+  MetricsHistogram phaseSeconds[METRICS_PHASES];
+  MetricsHistogram scanSeconds;
+  MetricsHistogram firstByteSeconds;
+  MetricsHistogram throughput;
+} Metrics;
+
+
+
+
+/*******************************************************************************
+ *  metricsInit() -    Zeroes metrics for the given device.
+ *
+ *  metricsRegister() - Adds metrics to what metricsWrite() reports.  They
+ *                     must stay around for as long as the process runs.
+ *
+ *  metricsCount() -   Adds n to a counter.  Only the owning thread may.
+ *
+ *  metricsObserve() - Adds value to a histogram.  Only the owning thread
+ *                     may.
+ *
+ *  metricsWrite() -   Writes every registered Metrics in the Prometheus
+ *                     text format.  Safe from any thread at any time.
+ *
+ *  metricsWriteFile() - Replaces path with the output of metricsWrite()
+ *                     and extra (which may be NULL), so a textfile
+ *                     collector never sees half a file.  Returns 0 on
+ *                     failure.
+ ******************************************************************************/
+void metricsInit (Metrics *metrics, int device);
+void metricsRegister (Metrics *metrics);
+void metricsCount (unsigned long *counter, unsigned long n);
+void metricsObserve (MetricsHistogram *histogram, double value);
+void metricsWrite (FILE *out);
+int metricsWriteFile (const char *path, const char *extra);
+
+#endif
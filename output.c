@@ -0,0 +1,185 @@
+/*******************************************************************************
+ *  output.c
+ *
+ *  Purpose: Writes scan data as PNM or raw bytes.  The ASCII writer is the
+ *           loop that used to be at the bottom of main(), with the text of
+ *           every byte value looked up in a table instead of printed.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "output.h"
+#include "trace.h"
+#include <pthread.h>
+#include <string.h>
+
+
+
+
+/*******************************************************************************
+ *  sampleText -   "n " for every byte value n, as P3 has it.
+ *
+ *  bitsText -     "0 " or "255 " for each bit of every byte value, high bit
+ *                 first, as P2 has it.
+ *
+ *  sampleLength, bitsLength - How long each of those is.
+ *
+ *  prepared -     Builds the tables just once.
+ ******************************************************************************/
+static char sampleText[256][4];
+static unsigned char sampleLength[256];
+static char bitsText[256][32];
+static unsigned char bitsLength[256];
+static pthread_once_t prepared = PTHREAD_ONCE_INIT;
+
+
+
+
+/*******************************************************************************
+ *  buildTables() -    Fills in sampleText and bitsText.
+ ******************************************************************************/
+static void buildTables (void);
+
+
+
+
+int outputFormatFromName (const char *name)
+{
+  if (!strcmp (name, "pnm-ascii"))
+    return OUTPUT_PNM_ASCII;
+
+  if (!strcmp (name, "pnm"))
+    return OUTPUT_PNM;
+
+  if (!strcmp (name, "raw"))
+    return OUTPUT_RAW;
+
+  if (!strcmp (name, "thumbnail"))
+    return OUTPUT_THUMBNAIL;
+
+  return -1;
+}
+
+void outputPrepare (void)
+{
+  pthread_once (&prepared, buildTables);
+}
+
+void outputHeader (FILE *out, int format, ScanParameters *params)
+{
+  int isColor = (params->format == SCAN_FORMAT_RGB);
+
+  if (format == OUTPUT_PNM_ASCII)
+  {
+    fprintf (out, "%s %d %d 255 ", isColor ? "P3" : "P2",
+	     params->pixelsPerLine, params->lines);
+  }
+  else if (format == OUTPUT_PNM)
+  {
+    /* PBM has no maxval */
+    if (isColor)
+      fprintf (out, "P6 %d %d 255\n", params->pixelsPerLine, params->lines);
+    else
+      fprintf (out, "P4 %d %d\n", params->pixelsPerLine, params->lines);
+  }
+}
+
+void outputData (FILE *out, int format, ScanParameters *params,
+		 const char *buffer, int length)
+{
+  struct timespec start;
+  char text[4096];
+  size_t used = 0;
+  int i;
+
+  /* See thumbnail.h */
+  if (format == OUTPUT_THUMBNAIL)
+    return;
+
+  if (tracing)
+    traceNow (&start);
+
+  if (format == OUTPUT_PNM_ASCII)
+  {
+    unsigned char value;
+
+    pthread_once (&prepared, buildTables);
+
+    for (i = 0; i < length; ++i)
+    {
+      /* Room for the longest, eight bits of "255 " */
+      if (used > sizeof (text) - 32)
+      {
+	fwrite (text, 1, used, out);
+	used = 0;
+      }
+
+      value = buffer[i];
+
+      /* Color scan */
+      if (params->format == SCAN_FORMAT_RGB)
+      {
+	memcpy (text + used, sampleText[value], sampleLength[value]);
+	used += sampleLength[value];
+      }
+      else			/* Black and white */
+      {
+	memcpy (text + used, bitsText[value], bitsLength[value]);
+	used += bitsLength[value];
+      }
+    }
+
+    fwrite (text, 1, used, out);
+  }
+  else if (format == OUTPUT_PNM && params->format == SCAN_FORMAT_GRAY)
+  {
+    /* The scanner sends 0 for black, PBM uses 1 for black */
+    for (i = 0; i < length; ++i)
+      putc (~buffer[i] & 0xff, out);
+  }
+  else
+  {
+    fwrite (buffer, 1, length, out);
+  }
+
+  if (tracing)
+  {
+    char args[48];
+
+    snprintf (args, sizeof (args), "\"format\":%d,\"bytes\":%d", format,
+	      length);
+    traceComplete ("output", "encode", &start, args);
+  }
+}
+
+
+static void buildTables (void)
+{
+  char number[8];
+  int value;
+  int j;
+
+  for (value = 0; value < 256; value++)
+  {
+    /* Not strings either, "255 " has no room for the '\0' */
+    sampleLength[value] = sprintf (number, "%d ", value);
+    memcpy (sampleText[value], number, sampleLength[value]);
+
+    /* "255 " eight times fills it exactly */
+    for (j = 7; j > -1; --j)
+    {
+      if (((value >> j) & 1) == 0)
+      {
+	memcpy (bitsText[value] + bitsLength[value], "0 ", 2);
+	bitsLength[value] += 2;
+      }
+      else
+      {
+	memcpy (bitsText[value] + bitsLength[value], "255 ", 4);
+	bitsLength[value] += 4;
+      }
+    }
+  }
+}
@@ -0,0 +1,53 @@
+/*******************************************************************************
+ *  output.h
+ *
+ *  Purpose: Turns the bytes returned from scannerRead() into an image file.
+ *
+ *           OUTPUT_PNM_ASCII - P3 (color) or P2 (text) with one number per
+ *                              sample.  This is what primascan has always
+ *                              written and what scanToGimp expects.
+ *           OUTPUT_PNM -       P6 (color) or P4 (text), the binary forms.
+ *           OUTPUT_RAW -       The bytes exactly as the scanner sent them.
+ *           OUTPUT_THUMBNAIL - A small PNG preview.  It is made from whole
+ *                              rows by thumbnail.h; outputHeader() and
+ *                              outputData() write nothing for it.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "scanner.h"
+#include <stdio.h>
+
+#define OUTPUT_PNM_ASCII 0
+#define OUTPUT_PNM       1
+#define OUTPUT_RAW       2
+#define OUTPUT_THUMBNAIL 3
+
+
+
+
+/*******************************************************************************
+ *  outputFormatFromName() - "pnm-ascii", "pnm", "raw" or "thumbnail".
+ *                     Returns -1 for anything else.
+ *
+ *  outputPrepare() -  Builds the tables the ASCII writer uses.  It is done
+ *                     by the first outputData() otherwise, so this is only
+ *                     needed to get it out of the way early, e.g. while the
+ *                     scanner is being set up.
+ *
+ *  outputHeader() -   Writes the file header, if the format has one.
+ *
+ *  outputData() -     Writes length bytes of scan data.
+ ******************************************************************************/
+int outputFormatFromName (const char *name);
+void outputPrepare (void);
+void outputHeader (FILE *out, int format, ScanParameters *params);
+void outputData (FILE *out, int format, ScanParameters *params,
+		 const char *buffer, int length);
+
+#endif
@@ -0,0 +1,275 @@
+/*******************************************************************************
+ *  primascan.hpp
+ *
+ *  Purpose: The engine for C++ programs that scan in-process.  A Session
+ *           owns one open scanner; scan() starts a scan and returns its
+ *           rows as a range of std::span, each borrowed from the engine
+ *           (see rowreader.h), so a row is only valid until the iterator
+ *           moves on.  Sessions and Rows can be moved but not copied, and
+ *           clean up after themselves: a scan that is dropped part way is
+ *           recovered, and the scanner is closed with its Session.
+ *
+ *             primascan::Session session ("sim");
+ *
+ *             for (std::span<const unsigned char> row : session.scan (100))
+ *               consume (row);
+ *
+ *           Errors are thrown as std::runtime_error.  Needs C++20; link
+ *           with libprimascan.a ('make libprimascan.a') and what the
+ *           transport needs (-lusb -lpthread -lrt).
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef PRIMASCAN_HPP
+#define PRIMASCAN_HPP
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+extern "C"
+{
+#include "rowreader.h"
+#include "scanner.h"
+#include "transport.h"
+}
+
+namespace primascan
+{
+
+
+
+
+/*******************************************************************************
+ *  Rows -         The rows of one scan, read as they are iterated.  It can
+ *                 be iterated once.
+ ******************************************************************************/
+class Rows
+{
+public:
+  using Row = std::span<const unsigned char>;
+
+  class iterator
+  {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = Row;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Row *;
+    using reference = const Row &;
+
+    iterator () = default;
+
+    reference operator* () const { return rows_->row_; }
+    pointer operator-> () const { return &rows_->row_; }
+    iterator &operator++ () { rows_->next (); return *this; }
+    void operator++ (int) { rows_->next (); }
+
+    bool operator== (std::default_sentinel_t) const
+    {
+      return rows_ == nullptr || rows_->done_;
+    }
+
+  private:
+    friend class Rows;
+    explicit iterator (Rows *rows) : rows_ (rows) {}
+
+    Rows *rows_ = nullptr;
+  };
+
+  Rows (Rows &&other) noexcept { *this = std::move (other); }
+
+  Rows &operator= (Rows &&other) noexcept
+  {
+    if (this != &other)
+    {
+      release ();
+      scanner_ = std::exchange (other.scanner_, nullptr);
+      reader_ = std::exchange (other.reader_, nullptr);
+      row_ = other.row_;
+      bytesPerLine_ = other.bytesPerLine_;
+      started_ = other.started_;
+      done_ = other.done_;
+      failed_ = other.failed_;
+    }
+
+    return *this;
+  }
+
+  Rows (const Rows &) = delete;
+  Rows &operator= (const Rows &) = delete;
+  ~Rows () { release (); }
+
+  /* The first row is read here, so a scan that fails at once throws */
+  iterator begin ()
+  {
+    if (!started_)
+    {
+      started_ = true;
+      next ();
+    }
+
+    return iterator (this);
+  }
+
+  std::default_sentinel_t end () const { return {}; }
+
+  /* Rows that were split between bulk reads and had to be copied */
+  long copied () const { return reader_ ? rowReaderCopied (reader_) : 0; }
+
+private:
+  friend class Session;
+
+  Rows (Scanner *scanner, RowReader *reader)
+    : scanner_ (scanner), reader_ (reader)
+  {
+    ScanParameters params;
+
+    scannerGetParameters (scanner, &params);
+    bytesPerLine_ = params.bytesPerLine;
+  }
+
+  void next ()
+  {
+    const char *row;
+
+    switch (rowReaderNext (reader_, &row))
+    {
+    case SCANNER_GOOD:
+      row_ = Row (reinterpret_cast<const unsigned char *> (row),
+		  bytesPerLine_);
+      break;
+
+    case SCANNER_EOF:
+      done_ = true;
+      row_ = Row ();
+      break;
+
+    default:
+      done_ = true;
+      failed_ = true;
+      throw std::runtime_error ("primascan: the scan failed");
+    }
+  }
+
+  void release ()
+  {
+    if (reader_ == nullptr)
+      return;
+
+    rowReaderDestroy (reader_);
+    reader_ = nullptr;
+
+    /* Put back a scanner that is in the middle of a scan or failed one */
+    if (!done_ || failed_)
+      scannerRecover (scanner_);
+  }
+
+  Scanner *scanner_ = nullptr;
+  RowReader *reader_ = nullptr;
+  Row row_;
+  std::size_t bytesPerLine_ = 0;
+  bool started_ = false;
+  bool done_ = false;
+  bool failed_ = false;
+};
+
+
+
+
+/*******************************************************************************
+ *  Session -      One open scanner.  transport is a name as for
+ *                 PRIMASCAN_TRANSPORT, or nullptr for the default.
+ ******************************************************************************/
+class Session
+{
+public:
+  explicit Session (const char *transport = nullptr, int index = 0)
+    : scanner_ (std::make_unique<Scanner> ())
+  {
+    const Transport *found = findTransport (transport);
+
+    if (found == nullptr)
+      throw std::runtime_error (std::string ("primascan: unknown transport ")
+				+ transport);
+
+    found->init ();
+
+    if (!scannerOpen (scanner_.get (), found, index))
+      throw std::runtime_error ("primascan: could not open the scanner");
+  }
+
+  Session (Session &&) noexcept = default;
+  Session &operator= (Session &&other) noexcept
+  {
+    if (this != &other)
+    {
+      close ();
+      scanner_ = std::move (other.scanner_);
+    }
+
+    return *this;
+  }
+
+  Session (const Session &) = delete;
+  Session &operator= (const Session &) = delete;
+  ~Session () { close (); }
+
+  /* 100 for color, 200 for black and white, as for primascan */
+  ScanParameters parameters (int dpi)
+  {
+    ScanParameters params;
+
+    scanner_->dpiValue = dpi;
+    scannerGetParameters (scanner_.get (), &params);
+    return params;
+  }
+
+  /* The Rows must go before the Session does */
+  Rows scan (int dpi)
+  {
+    int restarts = 0;
+
+    scanner_->dpiValue = dpi;
+
+    /* Nothing has been read yet, so starting over is safe */
+    while (scannerStart (scanner_.get ()) != SCANNER_GOOD)
+    {
+      if (restarts++ == SCANNER_MAX_RESTARTS ||
+	  !scannerRecover (scanner_.get ()))
+	throw std::runtime_error ("primascan: the scan could not start");
+    }
+
+    RowReader *reader = rowReaderCreate (scanner_.get ());
+
+    if (reader == nullptr)
+    {
+      scannerRecover (scanner_.get ());
+      throw std::bad_alloc ();
+    }
+
+    return Rows (scanner_.get (), reader);
+  }
+
+  /* For the options and metrics that are kept in the Scanner */
+  Scanner &scanner () { return *scanner_; }
+
+private:
+  void close ()
+  {
+    if (scanner_)
+      scannerClose (scanner_.get ());
+  }
+
+  std::unique_ptr<Scanner> scanner_;
+};
+
+} /* namespace primascan */
+
+#endif
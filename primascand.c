@@ -0,0 +1,918 @@
+/*******************************************************************************
+ *  primascand.c
+ *
+ *  Purpose: A scan daemon.  Running ./primascan for every scan means
+ *           usb_init, finding the bus, opening the scanner and sending
+ *           scannerSetup every single time.  primascand opens every
+ *           attached Colorado 2400u once, warms it up, and then takes scan
+ *           jobs over a Unix socket for as long as it runs.  The protocol
+ *           is described in primascand.h.
+ *
+ *           primascand [-s socket] [-f freshSeconds] [-m spoolBytes]
+ *                      [-p metricsPort] [-t metricsFile]
+ *
+ *           -m sets how much of a scan may be held in memory when the
+ *           outputs fall behind the scanner before the rest is spilled to
+ *           disk (see spool.h).
+ *
+ *           -p serves metrics for Prometheus on http://127.0.0.1:<port>/
+ *           and -t rewrites them to a file after every job, for the
+ *           node_exporter textfile collector (see metrics.h).
+ *
+ *           PRIMASCAN_TRANSPORT=sim runs it against simulated scanners,
+ *           PRIMASCAN_SIM_DEVICES sets how many.  PRIMASCAN_POLL_TIMEOUT
+ *           sets how many milliseconds a poll may wait before the scanner
+ *           is taken to have hung.  PRIMASCAN_SKIP_DEAD_READS=1 leaves out
+ *           the setup reads deadreads.pl classifies as dead, and
+ *           PRIMASCAN_QUEUE_CONTROL=0 waits for every setup write.
+ *
+ *           A scanner that fails is recovered (see scanner.h) and stays
+ *           in service.  A job that failed before any image data was read
+ *           is started again.
+ *
+ *           kill -USR1 (or the dump request) writes the flight recorder
+ *           of every scanner to a file (see flightrec.h).
+ *           PRIMASCAN_TRACE=<file> writes a timeline of every job (see
+ *           trace.h).  PRIMASCAN_PROFILE=<file> adds how long every
+ *           table entry took to file (see profile.h).
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#define _GNU_SOURCE
+#include "scanner.h"
+#include "thumbnail.h"
+#include "output.h"
+#include "primascand.h"
+#include "scheduler.h"
+#include "fanout.h"
+#include "shmring.h"
+#include "trace.h"
+#include "profile.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+/* How often a scanner that has gone away is looked for again */
+#define OFFLINE_RETRY_SECONDS 5
+
+
+
+
+/*******************************************************************************
+ *  Job -          One scan request.
+ *                 sched -    What the scheduler needs to know.  It must
+ *                            come first.
+ *                 client -   The connection the request came in on
+ *                 outs -     Where the image goes, one descriptor per
+ *                            output.  This is client itself if no
+ *                            descriptor (and no shm) was passed.
+ *                 formats -  The format for each output
+ *                 shmName -  A shared memory ring to publish to as well
+ *                 received - When the request was read, for latency
+ *
+ *  Output -       One output of a running job, either a file or a shared
+ *                 memory ring.  Each is a fan-out subscriber, so all of
+ *                 them are written from one scan.  A thumbnail output
+ *                 writes its thumbnail to the file, again every
+ *                 thumbnailEvery rows if that is not 0.
+ *
+ *  Device -       One open scanner and the thread that runs its jobs.
+ ******************************************************************************/
+typedef struct Job
+{
+  SchedulerJob sched;
+  int client;
+  int outs[FANOUT_MAX_SUBSCRIBERS];
+  int formats[FANOUT_MAX_SUBSCRIBERS];
+  int outputCount;
+  int thumbnailEvery;
+  char shmName[64];
+  struct timespec received;
+} Job;
+
+typedef struct Output
+{
+  FILE *out;
+  ShmRing *ring;
+  int format;
+  Thumbnail *thumbnail;
+  int thumbnailEvery;
+  long bytes;
+  struct timespec firstByte;
+} Output;
+
+typedef struct Device
+{
+  int index;
+  Scanner scanner;
+  pthread_t thread;
+} Device;
+
+
+
+
+/*******************************************************************************
+ *  Every device thread asks the scheduler for its next job.
+ *
+ *  devices -      Every scanner, for the recovery stats
+ *
+ *  spoolLimit -   Memory for each scan before it spills to disk (-m)
+ *
+ *  metricsFile -  Where to keep the metrics for a textfile collector (-t)
+ ******************************************************************************/
+static Scheduler *scheduler = NULL;
+static Device *devices = NULL;
+static int deviceCount = 0;
+static long spoolLimit = SPOOL_MEMORY_LIMIT;
+static const char *metricsFile = NULL;
+
+
+
+
+/*******************************************************************************
+ *  readRequest() -    Reads the request line and any passed descriptor from
+ *                     a new connection and turns it into a Job.  Returns
+ *                     NULL if it is bad or was not a scan (after answering
+ *                     the client).
+ *
+ *  runJob() -         Scans on the given device and writes the image.
+ *                     Returns 1 if the scan completed.
+ *
+ *  closeOutputs() -   Closes every descriptor that was passed with a job.
+ *
+ *  writeRows(), finishOutput() - The fan-out callbacks for an Output.
+ *
+ *  deviceThread() -   The loop each device thread runs.
+ *
+ *  printRecoveryStats() - One line per scanner on how often it was
+ *                     recovered, how, and the mean time to recover.
+ *
+ *  dumpFlight() -     SIGUSR1 handler.  Dumps every flight recorder.
+ *
+ *  queueMetric() -    The queue depth as a Prometheus gauge.
+ *
+ *  writeMetrics() -   Writes the metrics of every scanner and the queue
+ *                     depth.
+ *
+ *  updateMetricsFile() - Rewrites metricsFile, if there is one.
+ *
+ *  metricsThread() -  Answers every connection to the metrics port with the
+ *                     metrics.  arg is the listening socket.
+ *
+ *  elapsedMs() -      Milliseconds between two times.
+ ******************************************************************************/
+static Job *readRequest (int client);
+static int runJob (Device *device, Job *job);
+static void closeOutputs (Job *job);
+static void writeRows (void *user, ScanParameters *params, int firstRow,
+		       const char *data, int rows);
+static void finishOutput (void *user, int failed);
+static void *deviceThread (void *arg);
+static void printRecoveryStats (FILE *out);
+static void dumpFlight (int signal);
+static void queueMetric (char *text, int size);
+static void writeMetrics (FILE *out);
+static void updateMetricsFile (void);
+static void *metricsThread (void *arg);
+static double elapsedMs (struct timespec *from, struct timespec *to);
+
+
+
+
+int main (int argc, char *argv[])
+{
+  const char *socketPath = PRIMASCAND_SOCKET;
+  const Transport *transport;
+  int freshSeconds = 120;
+  int metricsPort = 0;
+  int i;
+
+  for (i = 1; i + 1 < argc; i += 2)
+  {
+    if (!strcmp (argv[i], "-s"))
+      socketPath = argv[i + 1];
+    else if (!strcmp (argv[i], "-f"))
+      freshSeconds = atoi (argv[i + 1]);
+    else if (!strcmp (argv[i], "-m"))
+      spoolLimit = atol (argv[i + 1]);
+    else if (!strcmp (argv[i], "-p"))
+      metricsPort = atoi (argv[i + 1]);
+    else if (!strcmp (argv[i], "-t"))
+      metricsFile = argv[i + 1];
+  }
+
+  transport = findTransport (getenv ("PRIMASCAN_TRANSPORT"));
+
+  if (transport == NULL)
+  {
+    fprintf (stderr, "Unknown transport %s\n", getenv ("PRIMASCAN_TRANSPORT"));
+    return 1;
+  }
+
+  /* A client that goes away mid-scan must not take us down with it */
+  signal (SIGPIPE, SIG_IGN);
+  signal (SIGUSR1, dumpFlight);
+  traceOpen (getenv ("PRIMASCAN_TRACE"));
+  profileOpen (getenv ("PRIMASCAN_PROFILE"));
+  outputPrepare ();
+
+  transport->init ();
+  deviceCount = transport->count ();
+
+  if (deviceCount < 1)
+  {
+    fprintf (stderr, "No Device Detected\n");
+    return 1;
+  }
+
+  /* Open and warm up every scanner */
+  devices = calloc (deviceCount, sizeof (Device));
+  scheduler = schedulerCreate (deviceCount, freshSeconds);
+
+  for (i = 0; i < deviceCount; i++)
+  {
+    devices[i].index = i;
+
+    if (!scannerOpen (&devices[i].scanner, transport, i))
+    {
+      fprintf (stderr, "Problem opening device %d\n", i);
+      return 1;
+    }
+
+    if (getenv ("PRIMASCAN_POLL_TIMEOUT") != NULL)
+      devices[i].scanner.pollTimeoutMs =
+	atoi (getenv ("PRIMASCAN_POLL_TIMEOUT"));
+
+    if (getenv ("PRIMASCAN_SKIP_DEAD_READS") != NULL)
+      devices[i].scanner.skipDeadReads =
+	atoi (getenv ("PRIMASCAN_SKIP_DEAD_READS"));
+
+    if (getenv ("PRIMASCAN_QUEUE_CONTROL") != NULL)
+      devices[i].scanner.queueControl &=
+	atoi (getenv ("PRIMASCAN_QUEUE_CONTROL")) != 0;
+
+    if (!scannerWarmUp (&devices[i].scanner))
+    {
+      fprintf (stderr, "Problem opening device %d\n", i);
+      return 1;
+    }
+
+    metricsRegister (&devices[i].scanner.metrics);
+
+    pthread_create (&devices[i].thread, NULL, deviceThread, &devices[i]);
+  }
+
+  fprintf (stderr, "primascand: %d %s scanner(s) ready\n", deviceCount,
+	   transport->name);
+
+  updateMetricsFile ();
+
+  /* Metrics for Prometheus, on this machine only */
+  if (metricsPort > 0)
+  {
+    struct sockaddr_in metricsAddress;
+    pthread_t thread;
+    int on = 1;
+    long metricsListener = socket (AF_INET, SOCK_STREAM, 0);
+
+    memset (&metricsAddress, 0, sizeof (metricsAddress));
+    metricsAddress.sin_family = AF_INET;
+    metricsAddress.sin_port = htons (metricsPort);
+    metricsAddress.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    setsockopt (metricsListener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+
+    if (metricsListener < 0 ||
+	bind (metricsListener, (struct sockaddr *) &metricsAddress,
+	      sizeof (metricsAddress)) < 0 || listen (metricsListener, 4) < 0)
+    {
+      fprintf (stderr, "Could not listen on port %d\n", metricsPort);
+      return 1;
+    }
+
+    pthread_create (&thread, NULL, metricsThread, (void *) metricsListener);
+  }
+
+  /* Listen for jobs */
+  struct sockaddr_un address;
+  int listener;
+
+  listener = socket (AF_UNIX, SOCK_STREAM, 0);
+
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  strncpy (address.sun_path, socketPath, sizeof (address.sun_path) - 1);
+  unlink (socketPath);
+
+  if (listener < 0 ||
+      bind (listener, (struct sockaddr *) &address, sizeof (address)) < 0 ||
+      listen (listener, 16) < 0)
+  {
+    fprintf (stderr, "Could not listen on %s\n", socketPath);
+    return 1;
+  }
+
+  while (1)
+  {
+    int client = accept (listener, NULL, NULL);
+    Job *job;
+
+    if (client < 0)
+      continue;
+
+    job = readRequest (client);
+
+    if (job != NULL)
+      schedulerSubmit (scheduler, &job->sched);
+  }
+}
+
+
+static Job *readRequest (int client)
+{
+  char request[256];
+  char control[CMSG_SPACE (FANOUT_MAX_SUBSCRIBERS * sizeof (int))];
+  struct iovec iov = { request, sizeof (request) - 1 };
+  struct msghdr message;
+  struct cmsghdr *cmsg;
+  struct timeval timeout = { 5, 0 };
+  int length;
+
+  /* Don't let one slow client hold up everyone else */
+  setsockopt (client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+
+  memset (&message, 0, sizeof (message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof (control);
+
+  length = recvmsg (client, &message, 0);
+
+  if (length <= 0)
+  {
+    close (client);
+    return NULL;
+  }
+
+  request[length] = '\0';
+
+  Job *job = calloc (1, sizeof (Job));
+  struct ucred peer;
+  socklen_t peerLength = sizeof (peer);
+
+  clock_gettime (CLOCK_MONOTONIC, &job->received);
+  job->client = client;
+  job->sched.dpiValue = 100;
+  job->sched.device = -1;
+
+  /* Unless it says otherwise, a client is whoever is on the other end */
+  if (!getsockopt (client, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength))
+    snprintf (job->sched.client, sizeof (job->sched.client), "uid%d",
+	      (int) peer.uid);
+
+  /* Were descriptors passed for the image? */
+  cmsg = CMSG_FIRSTHDR (&message);
+
+  if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+      cmsg->cmsg_type == SCM_RIGHTS)
+  {
+    job->outputCount = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+    memcpy (job->outs, CMSG_DATA (cmsg), job->outputCount * sizeof (int));
+  }
+
+  /* Parse "scan key=value ..." */
+  char *word = strtok (request, " \r\n");
+
+  if (word != NULL && !strcmp (word, "stats"))
+  {
+    FILE *out = fdopen (dup (client), "w");
+
+    if (out != NULL)
+    {
+      schedulerPrintStats (scheduler, out);
+      printRecoveryStats (out);
+      fclose (out);
+    }
+
+    goto done;
+  }
+
+  if (word != NULL && !strcmp (word, "metrics"))
+  {
+    FILE *out = fdopen (dup (client), "w");
+
+    if (out != NULL)
+    {
+      writeMetrics (out);
+      fclose (out);
+    }
+
+    goto done;
+  }
+
+  if (word != NULL && !strcmp (word, "dump"))
+  {
+    int i;
+
+    for (i = 0; i < deviceCount; i++)
+    {
+      if (flightDump (&devices[i].scanner.flight))
+	dprintf (client, "ok %s\n", devices[i].scanner.flight.path);
+      else
+	dprintf (client, "error could not write %s\n",
+		 devices[i].scanner.flight.path);
+    }
+
+    goto done;
+  }
+
+  if (word == NULL || strcmp (word, "scan"))
+    goto bad;
+
+  while ((word = strtok (NULL, " \r\n")) != NULL)
+  {
+    if (!strcmp (word, "mode=color"))
+      job->sched.dpiValue = 100;
+    else if (!strcmp (word, "mode=text"))
+      job->sched.dpiValue = 200;
+    else if (!strncmp (word, "priority=", 9))
+      job->sched.priority = atoi (word + 9);
+    else if (!strncmp (word, "client=", 7))
+      strncpy (job->sched.client, word + 7, sizeof (job->sched.client) - 1);
+    else if (!strncmp (word, "device=", 7))
+      job->sched.device = atoi (word + 7);
+    else if (!strncmp (word, "shm=", 4) &&
+	     job->outputCount < FANOUT_MAX_SUBSCRIBERS)
+      strncpy (job->shmName, word + 4, sizeof (job->shmName) - 1);
+    else if (!strncmp (word, "thumbnail_every=", 16))
+      job->thumbnailEvery = atoi (word + 16);
+    else if (!strncmp (word, "format=", 7))
+    {
+      /* One format per output, separated by commas */
+      char *format = word + 7;
+      int count = 0;
+
+      while (count < FANOUT_MAX_SUBSCRIBERS)
+      {
+	char *comma = strchr (format, ',');
+
+	if (comma != NULL)
+	  *comma = '\0';
+
+	if ((job->formats[count++] = outputFormatFromName (format)) < 0)
+	  goto bad;
+
+	if (comma == NULL)
+	  break;
+
+	format = comma + 1;
+      }
+
+      /* The last format listed is used for the rest */
+      while (count < FANOUT_MAX_SUBSCRIBERS)
+      {
+	job->formats[count] = job->formats[count - 1];
+	count++;
+      }
+    }
+    else
+      goto bad;
+  }
+
+  /* A job pinned to a scanner that isn't there would never run */
+  if (job->sched.device < -1 || job->sched.device >= deviceCount)
+  {
+    dprintf (client, "error no such device\n");
+    goto done;
+  }
+
+  /* With nowhere else to go, the image goes back on the socket */
+  if (job->outputCount == 0 && job->shmName[0] == '\0')
+  {
+    job->outs[0] = client;
+    job->outputCount = 1;
+  }
+
+  return job;
+
+bad:
+  dprintf (client, "error bad request\n");
+
+done:
+  closeOutputs (job);
+  close (client);
+  free (job);
+  return NULL;
+}
+
+
+static void *deviceThread (void *arg)
+{
+  Device *device = arg;
+  char name[32];
+
+  snprintf (name, sizeof (name), "device %d", device->index);
+  traceThreadName (name);
+
+  while (1)
+  {
+    /* A scanner that could not be opened again waits until it is back */
+    if (!device->scanner.isDeviceOpen)
+    {
+      schedulerSetOffline (scheduler, device->index, 1);
+      fprintf (stderr, "primascand: scanner %d is offline\n", device->index);
+
+      while (!scannerWarmUp (&device->scanner))
+	sleep (OFFLINE_RETRY_SECONDS);
+
+      fprintf (stderr, "primascand: scanner %d is back\n", device->index);
+      schedulerSetOffline (scheduler, device->index, 0);
+    }
+
+    Job *job = (Job *) schedulerNext (scheduler, device->index);
+
+    schedulerDone (scheduler, device->index, &job->sched,
+		   !runJob (device, job));
+    traceFlush ();
+    profileFlush ();
+    updateMetricsFile ();
+
+    closeOutputs (job);
+    close (job->client);
+    free (job);
+  }
+
+  return NULL;
+}
+
+
+static int runJob (Device *device, Job *job)
+{
+  Scanner *scanner = &device->scanner;
+  ScanParameters params;
+  Output outputs[FANOUT_MAX_SUBSCRIBERS];
+  struct timespec finished;
+  struct timespec *firstByte;
+  Fanout *fanout;
+  int outputCount = job->outputCount;
+  int status;
+  int i;
+
+  /* A failed job may have left the scanner anywhere */
+  if (!scanner->isWarm)
+    scannerWarmUp (scanner);
+
+  scanner->dpiValue = job->sched.dpiValue;
+  scannerGetParameters (scanner, &params);
+
+  /* About 64k per batch */
+  fanout = fanoutCreate (&params, 0x10000 / params.bytesPerLine, 8,
+			 spoolLimit);
+
+  if (fanout == NULL)
+  {
+    metricsCount (&scanner->metrics.failedScans, 1);
+    dprintf (job->client, "error out of memory\n");
+    return 0;
+  }
+
+  memset (outputs, 0, sizeof (outputs));
+
+  for (i = 0; i < job->outputCount; i++)
+  {
+    outputs[i].out = fdopen (dup (job->outs[i]), "w");
+    outputs[i].format = job->formats[i];
+
+    if (outputs[i].out == NULL)
+      break;
+
+    if (outputs[i].format == OUTPUT_THUMBNAIL)
+    {
+      outputs[i].thumbnail = thumbnailCreate (&params, THUMBNAIL_WIDTH);
+      outputs[i].thumbnailEvery = job->thumbnailEvery;
+
+      if (outputs[i].thumbnail == NULL)
+      {
+	fclose (outputs[i].out);
+	outputs[i].out = NULL;
+	break;
+      }
+    }
+  }
+
+  /* The shared memory ring goes after the files */
+  if (i == job->outputCount && job->shmName[0] != '\0')
+  {
+    outputs[outputCount].ring = shmRingCreate (job->shmName, &params,
+					       0x100000 /
+					       params.bytesPerLine);
+
+    if (outputs[outputCount].ring != NULL)
+      outputCount++;
+    else
+      i = -1;
+  }
+
+  if (i != job->outputCount)
+  {
+    for (i = 0; i < job->outputCount; i++)
+    {
+      if (outputs[i].out != NULL)
+	fclose (outputs[i].out);
+
+      if (outputs[i].thumbnail != NULL)
+	thumbnailDestroy (outputs[i].thumbnail);
+    }
+
+    fanoutDestroy (fanout);
+    metricsCount (&scanner->metrics.failedScans, 1);
+    dprintf (job->client, "error could not write image\n");
+    return 0;
+  }
+
+  for (i = 0; i < outputCount; i++)
+    fanoutSubscribe (fanout, writeRows, finishOutput, &outputs[i]);
+
+  /* Nothing has been read yet, so a failed start can simply be retried */
+  for (i = 0; (status = scannerStart (scanner)) != SCANNER_GOOD; i++)
+  {
+    if (i == SCANNER_MAX_RESTARTS || !scannerRecover (scanner))
+      break;
+
+    metricsCount (&scanner->metrics.restarts, 1);
+  }
+
+  if (status == SCANNER_GOOD)
+    status = fanoutRun (fanout, scanner);
+  else
+    status = SCANNER_ERROR;
+
+  /* Subscribers that never ran still own their outputs */
+  for (i = 0; i < outputCount; i++)
+  {
+    if (outputs[i].out != NULL || outputs[i].ring != NULL)
+      finishOutput (&outputs[i], 1);
+  }
+
+  if (fanoutSpilled (fanout) > 0)
+    fprintf (stderr, "primascand: scanner %d: outputs fell behind, "
+	     "%ld bytes spilled to disk\n", device->index,
+	     fanoutSpilled (fanout));
+
+  /* Would mean the image was larger than its parameters said */
+  if (fanoutAllocations (fanout) > 0)
+    fprintf (stderr, "primascand: scanner %d: %ld allocations while "
+	     "reading\n", device->index, fanoutAllocations (fanout));
+
+  fanoutDestroy (fanout);
+  clock_gettime (CLOCK_MONOTONIC, &finished);
+
+  if (status != SCANNER_EOF)
+  {
+    /* The image is lost, but the scanner need not be */
+    scannerRecover (scanner);
+    metricsCount (&scanner->metrics.failedScans, 1);
+    dprintf (job->client, "error scanner %d failed during the scan\n",
+	     device->index);
+    return 0;
+  }
+
+  /* Latency is to whichever output got its first byte first */
+  firstByte = &outputs[0].firstByte;
+
+  for (i = 1; i < outputCount; i++)
+  {
+    if (elapsedMs (&outputs[i].firstByte, firstByte) > 0)
+      firstByte = &outputs[i].firstByte;
+  }
+
+  fprintf (stderr, "primascand: scanner %d: %ld bytes to %d output(s), "
+	   "first byte %.1f ms, total %.1f ms\n", device->index,
+	   outputs[0].bytes, outputCount,
+	   elapsedMs (&job->received, firstByte),
+	   elapsedMs (&job->received, &finished));
+
+  /* A flatbed scan is always one page */
+  metricsCount (&scanner->metrics.scans, 1);
+  metricsCount (&scanner->metrics.pages, 1);
+  metricsCount (&scanner->metrics.bytes, outputs[0].bytes);
+  metricsObserve (&scanner->metrics.scanSeconds,
+		  elapsedMs (&job->received, &finished) / 1000.0);
+  metricsObserve (&scanner->metrics.firstByteSeconds,
+		  elapsedMs (&job->received, firstByte) / 1000.0);
+  metricsObserve (&scanner->metrics.throughput, outputs[0].bytes * 1000.0 /
+		  elapsedMs (&job->received, &finished));
+
+  /* Unless the image itself went back on the socket */
+  if (job->outputCount != 1 || job->outs[0] != job->client)
+    dprintf (job->client, "ok bytes=%ld first_byte_ms=%.3f total_ms=%.3f\n",
+	     outputs[0].bytes, elapsedMs (&job->received, firstByte),
+	     elapsedMs (&job->received, &finished));
+
+  /* The next job, whatever its mode, starts from here */
+  scannerPrime (scanner);
+  return 1;
+}
+
+
+static void writeRows (void *user, ScanParameters *params, int firstRow,
+		       const char *data, int rows)
+{
+  Output *output = user;
+  int length = rows * params->bytesPerLine;
+
+  if (output->ring != NULL)
+  {
+    shmRingPublish (output->ring, data, rows);
+  }
+  else if (output->thumbnail != NULL)
+  {
+    thumbnailRows (output->thumbnail, data, rows);
+
+    /* A preview so far, unless the last one is coming anyway */
+    if (output->thumbnailEvery > 0 && firstRow + rows < params->lines &&
+	(firstRow + rows) / output->thumbnailEvery >
+	firstRow / output->thumbnailEvery)
+    {
+      thumbnailWrite (output->thumbnail, output->out);
+      fflush (output->out);
+    }
+  }
+  else
+  {
+    if (firstRow == 0)
+      outputHeader (output->out, output->format, params);
+
+    outputData (output->out, output->format, params, data, length);
+
+    /* Push the first bytes out so the latency we report is real */
+    if (output->bytes == 0)
+      fflush (output->out);
+  }
+
+  if (output->bytes == 0)
+    clock_gettime (CLOCK_MONOTONIC, &output->firstByte);
+
+  output->bytes += length;
+}
+
+
+static void finishOutput (void *user, int failed)
+{
+  Output *output = user;
+
+  if (output->ring != NULL)
+  {
+    shmRingFinish (output->ring, failed);
+    shmRingClose (output->ring);
+    output->ring = NULL;
+  }
+  else
+  {
+    /* Only a whole scan makes the final thumbnail */
+    if (output->thumbnail != NULL)
+    {
+      if (!failed)
+	thumbnailWrite (output->thumbnail, output->out);
+
+      thumbnailDestroy (output->thumbnail);
+      output->thumbnail = NULL;
+    }
+
+    fclose (output->out);
+    output->out = NULL;
+  }
+}
+
+
+static void closeOutputs (Job *job)
+{
+  int i;
+
+  for (i = 0; i < job->outputCount; i++)
+  {
+    if (job->outs[i] != job->client)
+      close (job->outs[i]);
+  }
+}
+
+
+static void printRecoveryStats (FILE *out)
+{
+  int i;
+
+  for (i = 0; i < deviceCount; i++)
+  {
+    Scanner *scanner = &devices[i].scanner;
+
+    fprintf (out, "device %d recoveries=%d clear_halt=%d repoll=%d "
+	     "finalize=%d reset=%d unrecovered=%d mttr_ms=%.1f "
+	     "short_reads=%d\n", i,
+	     scanner->recoveries,
+	     scanner->recoveredBy[SCANNER_RECOVER_CLEAR_HALT],
+	     scanner->recoveredBy[SCANNER_RECOVER_REPOLL],
+	     scanner->recoveredBy[SCANNER_RECOVER_FINALIZE],
+	     scanner->recoveredBy[SCANNER_RECOVER_RESET],
+	     scanner->unrecovered,
+	     scanner->recoveries ?
+	     scanner->recoveryMs / scanner->recoveries : 0.0,
+	     scanner->shortReads);
+  }
+}
+
+
+static void dumpFlight (int signal)
+{
+  int i;
+
+  for (i = 0; i < deviceCount; i++)
+    flightDump (&devices[i].scanner.flight);
+}
+
+
+static void queueMetric (char *text, int size)
+{
+  snprintf (text, size, "# HELP primascan_queue_depth Jobs waiting for a "
+	    "scanner.\n# TYPE primascan_queue_depth gauge\n"
+	    "primascan_queue_depth %d\n", schedulerQueueDepth (scheduler));
+}
+
+
+static void writeMetrics (FILE *out)
+{
+  char queue[160];
+
+  queueMetric (queue, sizeof (queue));
+  metricsWrite (out);
+  fputs (queue, out);
+}
+
+
+static void updateMetricsFile (void)
+{
+  char queue[160];
+
+  if (metricsFile == NULL)
+    return;
+
+  queueMetric (queue, sizeof (queue));
+
+  if (!metricsWriteFile (metricsFile, queue))
+    fprintf (stderr, "primascand: could not write %s\n", metricsFile);
+}
+
+
+static void *metricsThread (void *arg)
+{
+  int listener = (long) arg;
+  struct timeval timeout = { 5, 0 };
+  char request[1024];
+  FILE *out;
+  int client;
+
+  while (1)
+  {
+    client = accept (listener, NULL, NULL);
+
+    if (client < 0)
+      continue;
+
+    /* Whatever was asked for, the answer is the same */
+    setsockopt (client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+    recv (client, request, sizeof (request), 0);
+
+    out = fdopen (client, "w");
+
+    if (out == NULL)
+    {
+      close (client);
+      continue;
+    }
+
+    fprintf (out, "HTTP/1.0 200 OK\r\n"
+	     "Content-Type: text/plain; version=0.0.4\r\n"
+	     "Connection: close\r\n\r\n");
+    writeMetrics (out);
+    fclose (out);
+  }
+
+  return NULL;
+}
+
+
+static double elapsedMs (struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) * 1000.0 +
+    (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
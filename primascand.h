@@ -0,0 +1,72 @@
+/*******************************************************************************
+ *  primascand.h
+ *
+ *  Purpose: The protocol spoken on primascand's Unix socket.
+ *
+ *  A client connects and sends one request line.  The message carrying the
+ *  line may also carry file descriptors (SCM_RIGHTS) for the image to be
+ *  written to, up to eight of them.
+ *
+ *      scan [mode=color|text] [format=pnm-ascii|pnm|raw|thumbnail[,...]]
+ *           [priority=<n>] [client=<name>] [device=<n>] [shm=<name>]
+ *           [thumbnail_every=<rows>]
+ *
+ *  mode defaults to color and format to pnm-ascii, the same as running
+ *  ./primascan directly.  When several descriptors are passed, format may
+ *  list one format for each; the last one listed is used for the rest.
+ *  Every output is written from the same scan.  shm also publishes the
+ *  rows to the shared memory ring called name (see shmring.h).
+ *
+ *  thumbnail is a PNG THUMBNAIL_WIDTH pixels wide (see thumbnail.h),
+ *  written when the scan is over.  With thumbnail_every, one is also
+ *  written after every that many rows, one PNG after the other, so a
+ *  preview can be shown while the page is scanned.
+ *
+ *  Jobs with a larger priority run first (default 0).  Clients with jobs
+ *  of the same priority take turns; client defaults to the uid of the
+ *  process on the other end of the socket.  device pins the job to one
+ *  scanner; a job for a scanner that does not exist is answered with
+ *  "error no such device".  A scanner that drops off the bus and cannot
+ *  be opened again is offline and gets no jobs until it is back; jobs
+ *  pinned to it wait.  See scheduler.h.
+ *
+ *  If descriptors were passed, the image is written to them and the daemon
+ *  answers on the socket with one line when the job is finished:
+ *
+ *      ok bytes=<n> first_byte_ms=<t> total_ms=<t>
+ *      error <reason>
+ *
+ *  bytes counts the image data written to the first output.
+ *  first_byte_ms is measured from the moment the request was read to the
+ *  moment the first image byte was written.  If no descriptor (or shm) was
+ *  passed, the image itself is streamed back on the socket and the socket
+ *  is closed at the end.
+ *
+ *      stats
+ *
+ *  answers with the queue depth and, for every scanner, the number of
+ *  jobs, queue wait, service time, utilization and whether it is idle,
+ *  busy or offline, then how often it was recovered and the mean time to
+ *  recover, one line each.
+ *
+ *      dump
+ *
+ *  writes the flight recorder of every scanner (see flightrec.h) and
+ *  answers "ok <file>" (or "error ...") for each.
+ *
+ *      metrics
+ *
+ *  answers with the counters and histograms of every scanner in the
+ *  Prometheus text format (see metrics.h).
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef PRIMASCAND_H
+#define PRIMASCAND_H
+
+#define PRIMASCAND_SOCKET "/tmp/primascand.sock"
+
+#endif
@@ -0,0 +1,416 @@
+/*******************************************************************************
+ *  primascanmodule.c
+ *
+ *  Purpose: A Python module for analysing scans without going through the
+ *           PNM from primascan.  'make python' builds it.
+ *
+ *             import primascan, numpy
+ *
+ *             scanner = primascan.Scanner ()        # PRIMASCAN_TRANSPORT
+ *             page = scanner.scan (100)             # 200 for text
+ *             image = numpy.asarray (page)          # no copy
+ *
+ *           A Page holds one whole scan in memory the engine read it into,
+ *           and hands that memory out through the buffer protocol:
+ *           height x width x 3 bytes for color, and for text height x
+ *           bytes_per_line bytes of packed bits, most significant bit
+ *           first and 0 for black, as the scanner sends them
+ *           (numpy.unpackbits() opens them up).  Nothing is copied to
+ *           make the array; the page stays alive for as long as an array
+ *           uses it.
+ *
+ *           The scan runs without the GIL, so other Python threads (or
+ *           another Scanner) keep going meanwhile.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "scanner.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+
+
+
+/*******************************************************************************
+ *  ScannerObject - An open scanner.  The Scanner is allocated on its own,
+ *                 it is too large to be a Python object.  busy is set
+ *                 while a scan runs without the GIL.
+ *
+ *  PageObject -   One scan.  shape and strides are what the buffer
+ *                 protocol hands out, ndim of them.
+ ******************************************************************************/
+typedef struct ScannerObject
+{
+  PyObject_HEAD
+  Scanner *scanner;
+  int busy;
+} ScannerObject;
+
+typedef struct PageObject
+{
+  PyObject_HEAD
+  ScanParameters params;
+  char *data;
+  Py_ssize_t length;
+  int ndim;
+  Py_ssize_t shape[3];
+  Py_ssize_t strides[3];
+} PageObject;
+
+static PyTypeObject ScannerType;
+static PyTypeObject PageType;
+
+
+
+
+/*******************************************************************************
+ *  readPage() -       Starts a scan and reads all of it into data, length
+ *                     bytes.  Runs without the GIL.  Returns 1 on success;
+ *                     the scanner has been recovered if not.
+ ******************************************************************************/
+static int readPage (Scanner *scanner, char *data, Py_ssize_t length);
+
+
+
+
+/*******************************************************************************
+ *  Scanner
+ ******************************************************************************/
+static int Scanner_init (ScannerObject *self, PyObject *args,
+			 PyObject *kwargs)
+{
+  static char *keywords[] = { "transport", "index", NULL };
+  const char *name = getenv ("PRIMASCAN_TRANSPORT");
+  const Transport *transport;
+  int index = 0;
+  int opened;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwargs, "|zi", keywords, &name,
+				    &index))
+    return -1;
+
+  transport = findTransport (name);
+
+  if (transport == NULL)
+  {
+    PyErr_Format (PyExc_ValueError, "unknown transport %s", name);
+    return -1;
+  }
+
+  if (self->scanner != NULL)
+  {
+    PyErr_SetString (PyExc_RuntimeError, "the scanner is already open");
+    return -1;
+  }
+
+  self->scanner = calloc (1, sizeof (Scanner));
+
+  if (self->scanner == NULL)
+  {
+    PyErr_NoMemory ();
+    return -1;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  transport->init ();
+  opened = scannerOpen (self->scanner, transport, index);
+  Py_END_ALLOW_THREADS
+
+  if (!opened)
+  {
+    free (self->scanner);
+    self->scanner = NULL;
+    PyErr_SetString (PyExc_OSError, "could not open the scanner");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void Scanner_dealloc (ScannerObject *self)
+{
+  if (self->scanner != NULL)
+  {
+    scannerClose (self->scanner);
+    free (self->scanner);
+  }
+
+  Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static PyObject *Scanner_scan (ScannerObject *self, PyObject *args,
+			       PyObject *kwargs)
+{
+  static char *keywords[] = { "dpi", NULL };
+  PageObject *page;
+  int dpi = 100;
+  int result;
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwargs, "|i", keywords, &dpi))
+    return NULL;
+
+  if (self->scanner == NULL || self->busy)
+  {
+    PyErr_SetString (PyExc_RuntimeError, self->busy ?
+		     "the scanner is already scanning" :
+		     "the scanner is not open");
+    return NULL;
+  }
+
+  page = PyObject_New (PageObject, &PageType);
+
+  if (page == NULL)
+    return NULL;
+
+  self->scanner->dpiValue = dpi;
+  scannerGetParameters (self->scanner, &page->params);
+
+  page->length = (Py_ssize_t) page->params.bytesPerLine * page->params.lines;
+  page->data = malloc (page->length);
+
+  if (page->data == NULL)
+  {
+    Py_DECREF (page);
+    return PyErr_NoMemory ();
+  }
+
+  if (page->params.format == SCAN_FORMAT_RGB)
+  {
+    page->ndim = 3;
+    page->shape[0] = page->params.lines;
+    page->shape[1] = page->params.pixelsPerLine;
+    page->shape[2] = 3;
+    page->strides[0] = page->params.bytesPerLine;
+    page->strides[1] = 3;
+    page->strides[2] = 1;
+  }
+  else
+  {
+    page->ndim = 2;
+    page->shape[0] = page->params.lines;
+    page->shape[1] = page->params.bytesPerLine;
+    page->strides[0] = page->params.bytesPerLine;
+    page->strides[1] = 1;
+  }
+
+  /* Another thread may call in while the GIL is let go */
+  self->busy = 1;
+
+  Py_BEGIN_ALLOW_THREADS
+  result = readPage (self->scanner, page->data, page->length);
+  Py_END_ALLOW_THREADS
+
+  self->busy = 0;
+
+  if (!result)
+  {
+    Py_DECREF (page);
+    PyErr_SetString (PyExc_OSError, "the scan failed");
+    return NULL;
+  }
+
+  return (PyObject *) page;
+}
+
+static PyObject *Scanner_close (ScannerObject *self, PyObject *unused)
+{
+  if (self->busy)
+  {
+    PyErr_SetString (PyExc_RuntimeError, "the scanner is scanning");
+    return NULL;
+  }
+
+  if (self->scanner != NULL)
+  {
+    scannerClose (self->scanner);
+    free (self->scanner);
+    self->scanner = NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef Scanner_methods[] = {
+  {"scan", (PyCFunction) Scanner_scan, METH_VARARGS | METH_KEYWORDS,
+   "scan(dpi=100) -> Page\n\nScans one page, 100 dpi color or 200 dpi "
+   "text."},
+  {"close", (PyCFunction) Scanner_close, METH_NOARGS,
+   "Closes the scanner."},
+  {NULL}
+};
+
+static PyTypeObject ScannerType = {
+  PyVarObject_HEAD_INIT (NULL, 0)
+  .tp_name = "primascan.Scanner",
+  .tp_basicsize = sizeof (ScannerObject),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_doc = "Scanner(transport=None, index=0)\n\nAn open Colorado 2400u.",
+  .tp_new = PyType_GenericNew,
+  .tp_init = (initproc) Scanner_init,
+  .tp_dealloc = (destructor) Scanner_dealloc,
+  .tp_methods = Scanner_methods,
+};
+
+
+
+
+/*******************************************************************************
+ *  Page
+ ******************************************************************************/
+static int Page_getbuffer (PageObject *self, Py_buffer *view, int flags)
+{
+  if (flags & PyBUF_WRITABLE)
+  {
+    PyErr_SetString (PyExc_BufferError, "a page is read-only");
+    view->obj = NULL;
+    return -1;
+  }
+
+  view->obj = (PyObject *) self;
+  view->buf = self->data;
+  view->len = self->length;
+  view->readonly = 1;
+  view->itemsize = 1;
+  view->format = (flags & PyBUF_FORMAT) ? "B" : NULL;
+  view->ndim = self->ndim;
+  view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+  view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ?
+    self->strides : NULL;
+  view->suboffsets = NULL;
+  view->internal = NULL;
+
+  Py_INCREF (self);
+  return 0;
+}
+
+static void Page_dealloc (PageObject *self)
+{
+  free (self->data);
+  Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static PyObject *Page_getMode (PageObject *self, void *closure)
+{
+  return PyUnicode_FromString (self->params.format == SCAN_FORMAT_RGB ?
+			       "color" : "text");
+}
+
+static PyObject *Page_getInt (PageObject *self, void *closure)
+{
+  return PyLong_FromLong (*(int *) ((char *) &self->params +
+				    (Py_ssize_t) closure));
+}
+
+static PyGetSetDef Page_getset[] = {
+  {"mode", (getter) Page_getMode, NULL, "\"color\" or \"text\"", NULL},
+  {"width", (getter) Page_getInt, NULL, "Pixels per row",
+   (void *) offsetof (ScanParameters, pixelsPerLine)},
+  {"height", (getter) Page_getInt, NULL, "Rows",
+   (void *) offsetof (ScanParameters, lines)},
+  {"depth", (getter) Page_getInt, NULL, "Bits per sample",
+   (void *) offsetof (ScanParameters, depth)},
+  {"bytes_per_line", (getter) Page_getInt, NULL, "Bytes per row",
+   (void *) offsetof (ScanParameters, bytesPerLine)},
+  {NULL}
+};
+
+static PyBufferProcs Page_buffer = {
+  (getbufferproc) Page_getbuffer,
+  NULL
+};
+
+static PyTypeObject PageType = {
+  PyVarObject_HEAD_INIT (NULL, 0)
+  .tp_name = "primascan.Page",
+  .tp_basicsize = sizeof (PageObject),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_doc = "One scanned page.  It supports the buffer protocol, so\n"
+    "numpy.asarray(page) or memoryview(page) see it without a copy.",
+  .tp_dealloc = (destructor) Page_dealloc,
+  .tp_as_buffer = &Page_buffer,
+  .tp_getset = Page_getset,
+};
+
+
+
+
+/*******************************************************************************
+ *  The module
+ ******************************************************************************/
+static struct PyModuleDef primascanModule = {
+  PyModuleDef_HEAD_INIT,
+  .m_name = "primascan",
+  .m_doc = "Scans with a Colorado 2400u into memory Python can use.",
+  .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_primascan (void)
+{
+  PyObject *module;
+
+  if (PyType_Ready (&ScannerType) < 0 || PyType_Ready (&PageType) < 0)
+    return NULL;
+
+  module = PyModule_Create (&primascanModule);
+
+  if (module == NULL)
+    return NULL;
+
+  Py_INCREF (&ScannerType);
+  Py_INCREF (&PageType);
+
+  if (PyModule_AddObject (module, "Scanner", (PyObject *) &ScannerType) < 0 ||
+      PyModule_AddObject (module, "Page", (PyObject *) &PageType) < 0)
+  {
+    Py_DECREF (module);
+    return NULL;
+  }
+
+  return module;
+}
+
+
+static int readPage (Scanner *scanner, char *data, Py_ssize_t length)
+{
+  char rest[0x1000];
+  Py_ssize_t done = 0;
+  int restarts = 0;
+  int status;
+  int count;
+
+  /* Nothing has been read yet, so starting over is safe */
+  while (scannerStart (scanner) != SCANNER_GOOD)
+  {
+    if (restarts++ == SCANNER_MAX_RESTARTS || !scannerRecover (scanner))
+      return 0;
+  }
+
+  /* Straight into the page, there is no buffer in between */
+  do
+  {
+    count = length - done > 0x10000 ? 0x10000 : length - done;
+    status = scannerRead (scanner, data + done, count, &count);
+    done += count;
+  }
+  while (status == SCANNER_GOOD && done < length);
+
+  /* Read on so finalize runs.  There should be nothing more */
+  while (status == SCANNER_GOOD)
+  {
+    status = scannerRead (scanner, rest, sizeof (rest), &count);
+    done += count;
+  }
+
+  if (status != SCANNER_EOF || done != length)
+  {
+    scannerRecover (scanner);
+    return 0;
+  }
+
+  return 1;
+}
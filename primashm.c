@@ -0,0 +1,152 @@
+/*******************************************************************************
+ *  primashm.c
+ *
+ *  Purpose: Reads a scan out of a shared memory ring (see shmring.h) as it
+ *           is published and writes it to stdout.  It is both a small
+ *           example of a ring reader and a way to save what a preview
+ *           process would have seen.
+ *
+ *           ./primashm [-f pnm-ascii|pnm|raw] /name > [filename].pnm
+ *
+ *           Start it after the scan has started, ./primascan --shm /name
+ *           creates the ring when the scanner is ready.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "shmring.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Rows copied out of the ring at a time */
+#define COPY_ROWS 64
+
+
+
+
+/*******************************************************************************
+ *  Main() - Attaches to the ring, waits for rows and writes each one as
+ *           soon as it is published.  Rows are copied out and checked
+ *           before they are written, so a torn row is never written.
+ *           Gives up if nothing arrives for ten seconds.  Exits with 1 if
+ *           rows were lost or the scan failed.
+ ******************************************************************************/
+int main (int argc, char *argv[])
+{
+  const ShmRingHeader *header;
+  ScanParameters params;
+  ShmRing *ring = NULL;
+  char *copy;
+  int format = OUTPUT_PNM;
+  unsigned int row = 0;
+  unsigned int cursor;
+  int option;
+  int tries;
+
+  while ((option = getopt (argc, argv, "f:")) != -1)
+  {
+    if (option == 'f' && outputFormatFromName (optarg) >= 0)
+      format = outputFormatFromName (optarg);
+    else
+    {
+      fprintf (stderr, "usage: %s [-f pnm-ascii|pnm|raw] /name\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1)
+  {
+    fprintf (stderr, "usage: %s [-f pnm-ascii|pnm|raw] /name\n", argv[0]);
+    return 1;
+  }
+
+  /* The scan may not have got as far as creating it yet */
+  for (tries = 0; tries < 100 && ring == NULL; tries++)
+  {
+    ring = shmRingAttach (argv[optind]);
+
+    if (ring == NULL)
+      usleep (100000);
+  }
+
+  if (ring == NULL)
+  {
+    fprintf (stderr, "Could not attach to %s\n", argv[optind]);
+    return 1;
+  }
+
+  header = shmRingGetHeader (ring);
+
+  params.format = header->format;
+  params.lines = header->height;
+  params.depth = header->depth;
+  params.pixelsPerLine = header->width;
+  params.bytesPerLine = header->rowStride;
+
+  copy = malloc ((long) COPY_ROWS * params.bytesPerLine);
+
+  if (copy == NULL)
+  {
+    shmRingClose (ring);
+    return 1;
+  }
+
+  outputHeader (stdout, format, &params);
+
+  while (row < (unsigned int) params.lines)
+  {
+    cursor = shmRingWait (ring, row, 10000);
+
+    /* Nothing new: finished early, failed or stalled */
+    if (cursor == row)
+      break;
+
+    /* Rows are contiguous up to where the ring wraps */
+    while (row < cursor && shmRingIntact (ring, row))
+    {
+      int rows = header->ringRows - row % header->ringRows;
+
+      if (rows > (int) (cursor - row))
+	rows = cursor - row;
+
+      if (rows > COPY_ROWS)
+	rows = COPY_ROWS;
+
+      memcpy (copy, shmRingRow (ring, row),
+	      (long) rows * params.bytesPerLine);
+
+      /* The writer may have come round again while they were copied */
+      if (!shmRingIntact (ring, row))
+	break;
+
+      outputData (stdout, format, &params, copy, rows * params.bytesPerLine);
+      row += rows;
+    }
+
+    /* Overwritten before we got to them */
+    if (row < cursor)
+    {
+      fprintf (stderr, "Lost rows from %u\n", row);
+      break;
+    }
+  }
+
+  free (copy);
+
+  fflush (stdout);
+
+  if (row < (unsigned int) params.lines || header->state == SHMRING_FAILED)
+  {
+    fprintf (stderr, "Scan incomplete, %u of %d rows\n", row, params.lines);
+    shmRingClose (ring);
+    return 1;
+  }
+
+  shmRingClose (ring);
+  return 0;
+}
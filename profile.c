@@ -0,0 +1,95 @@
+/*******************************************************************************
+ *  profile.c
+ *
+ *  Purpose: Writes the per-entry profile.  See profile.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "profile.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+
+
+/*******************************************************************************
+ *  profileFile -      Where the lines go.  The lock keeps lines from the
+ *                     scanners of primascand apart.
+ ******************************************************************************/
+int profiling = 0;
+
+static FILE *profileFile = NULL;
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+void profileOpen (const char *path)
+{
+  if (path == NULL || path[0] == '\0')
+    return;
+
+  profileFile = fopen (path, "a");
+
+  if (profileFile == NULL)
+  {
+    fprintf (stderr, "Could not write profile to %s\n", path);
+    return;
+  }
+
+  profiling = 1;
+  atexit (profileClose);
+}
+
+void profileEntry (const char *table, int index, const int *entry,
+		   struct timespec *start)
+{
+  struct timespec now;
+
+  if (!profiling)
+    return;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock (&profileLock);
+
+  /* It may have been closed since we looked */
+  if (profileFile != NULL)
+    fprintf (profileFile, "%s %d %x %x %x %x %x %x %x %x %x %x %.1f\n",
+	     table, index, entry[0], entry[1], entry[2], entry[3], entry[4],
+	     entry[5], entry[6], entry[7], entry[8], entry[9],
+	     (now.tv_sec - start->tv_sec) * 1000000.0 +
+	     (now.tv_nsec - start->tv_nsec) / 1000.0);
+  pthread_mutex_unlock (&profileLock);
+}
+
+void profileFlush (void)
+{
+  if (!profiling)
+    return;
+
+  pthread_mutex_lock (&profileLock);
+
+  if (profileFile != NULL)
+    fflush (profileFile);
+  pthread_mutex_unlock (&profileLock);
+}
+
+void profileClose (void)
+{
+  if (!profiling)
+    return;
+
+  pthread_mutex_lock (&profileLock);
+  profiling = 0;
+
+  if (profileFile != NULL)
+    fclose (profileFile);
+
+  profileFile = NULL;
+  pthread_mutex_unlock (&profileLock);
+}
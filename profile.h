@@ -0,0 +1,59 @@
+/*******************************************************************************
+ *  profile.h
+ *
+ *  Purpose: An opt-in record of how long every entry of the sequence
+ *           tables took, so the entries worth speeding up can be found
+ *           from many scans instead of guessed from the tables.
+ *
+ *           PRIMASCAN_PROFILE=<file> turns it on for primascan and
+ *           primascand.  Every entry that is run appends one line
+ *
+ *             table index e0 e1 ... e9 microseconds
+ *
+ *           with the first ten numbers of the entry in hex.  Retries while
+ *           recovering count towards the entry.  The file is appended to,
+ *           so scans run one after another add up; profile.pl ranks the
+ *           entries.
+ *
+ *           When it is off every profile point is a test of one variable.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <time.h>
+
+
+
+
+/*******************************************************************************
+ *  profiling -        Non-zero while a profile is being written.  Check it
+ *                     before reading the clock for a profile point.
+ ******************************************************************************/
+extern int profiling;
+
+
+
+
+/*******************************************************************************
+ *  profileOpen() -    Starts appending to the profile at path, if it is not
+ *                     NULL or empty.  The profile is closed at exit.
+ *
+ *  profileEntry() -   Records that entry index of table, started at start,
+ *                     has just finished.
+ *
+ *  profileFlush() -   Pushes what has been recorded so far to the file.
+ *
+ *  profileClose() -   Closes the profile.
+ ******************************************************************************/
+void profileOpen (const char *path);
+void profileEntry (const char *table, int index, const int *entry,
+		   struct timespec *start);
+void profileFlush (void);
+void profileClose (void);
+
+#endif
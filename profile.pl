@@ -0,0 +1,89 @@
+#! /usr/bin/perl
+
+# ranks the sequence table entries of a profile (see profile.h)
+#
+#   ./profile.pl [--top n] [--by total|mean|p99] file ...
+#
+# adds up every run of every entry in the profiles and prints the entries
+# that took the most time in total (or by mean or 99th percentile), the top
+# n of them (default 25): table and index, what the entry does, how often
+# it ran, mean and p99 in milliseconds, and its share of all the time in
+# the profile.  Entries of the same table and index are the same entry, so
+# profiles of many scans and of several scanners can be given together.
+
+use strict;
+use warnings;
+use Getopt::Long;
+
+my $top = 25;
+my $by = 'total';
+
+GetOptions('top=i' => \$top, 'by=s' => \$by)
+    or die "usage: $0 [--top n] [--by total|mean|p99] file ...\n";
+die "$0: --by is total, mean or p99\n" unless $by =~ /^(total|mean|p99)$/;
+
+my %entries;
+my $allTime = 0;
+
+while (my $line = <>) {
+    my ($table, $index, @rest) = split(' ', $line);
+    next unless defined $index && @rest == 11;
+
+    my $micros = pop(@rest);
+    my $entry = $entries{"$table $index"} //= {
+        table => $table, index => $index,
+        fields => [ map { hex } @rest ], times => [] };
+
+    push(@{$entry->{times}}, $micros);
+    $entry->{total} += $micros;
+    $allTime += $micros;
+}
+
+die "$0: nothing profiled\n" unless $allTime;
+
+foreach my $entry (values %entries) {
+    my @sorted = sort { $a <=> $b } @{$entry->{times}};
+
+    $entry->{count} = @sorted;
+    $entry->{mean} = $entry->{total} / @sorted;
+    $entry->{p99} = $sorted[int(0.99 * $#sorted + 0.5)];
+}
+
+my @ranked = sort { $b->{$by} <=> $a->{$by} } values %entries;
+splice(@ranked, $top) if @ranked > $top;
+
+printf("%-18s %-44s %7s %10s %10s %7s\n", 'entry', 'transfer', 'runs',
+       'mean ms', 'p99 ms', 'share');
+
+foreach my $entry (@ranked) {
+    printf("%-18s %-44s %7d %10.3f %10.3f %6.1f%%\n",
+           "$entry->{table} $entry->{index}", describe(@{$entry->{fields}}),
+           $entry->{count}, $entry->{mean} / 1000, $entry->{p99} / 1000,
+           100 * $entry->{total} / $allTime);
+}
+
+printf("\n%d entries, %.1f ms in all\n", scalar keys %entries,
+       $allTime / 1000);
+
+
+# what a table entry does, the way bulkRead() and friends in scanner.c
+# take the tables in primascan.h apart
+sub describe {
+    my @f = @_;
+
+    return sprintf('bulk read ep 0x%02x, %d bytes', $f[1],
+                   ($f[2] << 8) + $f[3])
+        if $f[0] == 0xfa;
+    return sprintf('poll 0x%02x 0x%02x value 0x%04x index 0x%04x for 0x%02x',
+                   $f[1], $f[2], ($f[4] << 8) + $f[3], ($f[6] << 8) + $f[5],
+                   $f[9])
+        if $f[0] == 0xfb;
+    return 'calibration write' if $f[0] == 0xfc;
+    return 'calibrate' if $f[0] == 0xfd;
+    return sprintf('bulk write of 0s ep 0x%02x, %d bytes', $f[1],
+                   ($f[2] << 8) + $f[1])
+        if $f[0] == 0xff;
+
+    return sprintf('control 0x%02x 0x%02x value 0x%04x index 0x%04x', $f[0],
+                   $f[1], ($f[3] << 8) + $f[2], ($f[5] << 8) + $f[4]);
+}
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ *  rowreader.c
+ *
+ *  Purpose: Whole rows out of the engine.  See rowreader.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "rowreader.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+
+/*******************************************************************************
+ *  RowReader -    data, available - What scannerBorrow() returned that has
+ *                                   not been handed out yet
+ *                 row -             Rows handed out so far
+ *                 split, splitLength - The row being put together from two
+ *                                   bulk reads, and how much of it there is
+ ******************************************************************************/
+struct RowReader
+{
+  Scanner *scanner;
+  int bytesPerLine;
+  int lines;
+
+  const char *data;
+  int available;
+  int row;
+
+  char *split;
+  int splitLength;
+  long copied;
+};
+
+
+
+
+RowReader *rowReaderCreate (Scanner *scanner)
+{
+  ScanParameters params;
+  RowReader *reader;
+
+  scannerGetParameters (scanner, &params);
+
+  /* The row buffer goes right after the reader */
+  reader = calloc (1, sizeof (RowReader) + params.bytesPerLine);
+
+  if (reader == NULL)
+    return NULL;
+
+  reader->scanner = scanner;
+  reader->bytesPerLine = params.bytesPerLine;
+  reader->lines = params.lines;
+  reader->split = (char *) (reader + 1);
+
+  return reader;
+}
+
+int rowReaderNext (RowReader *reader, const char **row)
+{
+  int status;
+  int count;
+
+  /* Every row is out, read on so the scan is finished */
+  if (reader->row == reader->lines)
+  {
+    while ((status = scannerBorrow (reader->scanner, &reader->data, INT_MAX,
+				    &reader->available)) == SCANNER_GOOD)
+      ;
+
+    return status;
+  }
+
+  while (1)
+  {
+    /* The whole row is in the bulk buffer, hand it out from there */
+    if (reader->splitLength == 0 && reader->available >= reader->bytesPerLine)
+    {
+      *row = reader->data;
+      reader->data += reader->bytesPerLine;
+      reader->available -= reader->bytesPerLine;
+      reader->row++;
+      return SCANNER_GOOD;
+    }
+
+    /* Keep what there is of the row before the next bulk read */
+    if (reader->available > 0)
+    {
+      count = reader->bytesPerLine - reader->splitLength;
+
+      if (count > reader->available)
+	count = reader->available;
+
+      memcpy (reader->split + reader->splitLength, reader->data, count);
+      reader->splitLength += count;
+      reader->data += count;
+      reader->available -= count;
+
+      if (reader->splitLength == reader->bytesPerLine)
+      {
+	*row = reader->split;
+	reader->splitLength = 0;
+	reader->row++;
+	reader->copied++;
+	return SCANNER_GOOD;
+      }
+    }
+
+    status = scannerBorrow (reader->scanner, &reader->data, INT_MAX,
+			    &reader->available);
+
+    /* Out of data before the last row */
+    if (status != SCANNER_GOOD)
+      return SCANNER_ERROR;
+  }
+}
+
+long rowReaderCopied (RowReader *reader)
+{
+  return reader->copied;
+}
+
+void rowReaderDestroy (RowReader *reader)
+{
+  free (reader);
+}
@@ -0,0 +1,50 @@
+/*******************************************************************************
+ *  rowreader.h
+ *
+ *  Purpose: Reads a scan one whole row at a time, for programs that link
+ *           the engine in instead of going through primascan or
+ *           primascand.  scannerRead() hands out whatever the last bulk
+ *           read happened to return, which is rarely a whole number of
+ *           rows.  A RowReader hands out rows, each in place in the
+ *           engine's bulk buffer.  Only a row that is split between two
+ *           bulk reads is put together in a buffer of its own.
+ *
+ *           primascan.hpp wraps it for C++.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef ROWREADER_H
+#define ROWREADER_H
+
+#include "scanner.h"
+
+typedef struct RowReader RowReader;
+
+
+
+
+/*******************************************************************************
+ *  rowReaderCreate() - Reads the scan of scanner, which scannerStart() must
+ *                     have started, in rows of scannerGetParameters().
+ *                     Returns NULL if there is not enough memory.
+ *
+ *  rowReaderNext() -  Points *row at the next row, which is good until the
+ *                     next call.  Returns SCANNER_GOOD, SCANNER_EOF once
+ *                     every row has been read and the scan is finished, or
+ *                     SCANNER_ERROR.  A scan that ends early is an error.
+ *
+ *  rowReaderCopied() - How many rows so far had to be put together.
+ *
+ *  rowReaderDestroy() - Frees the reader.  The scanner is left where it
+ *                     is; if the scan was not read to the end, it needs
+ *                     scannerRecover().
+ ******************************************************************************/
+RowReader *rowReaderCreate (Scanner *scanner);
+int rowReaderNext (RowReader *reader, const char **row);
+long rowReaderCopied (RowReader *reader);
+void rowReaderDestroy (RowReader *reader);
+
+#endif
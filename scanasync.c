@@ -0,0 +1,217 @@
+/*******************************************************************************
+ *  scanasync.c
+ *
+ *  Purpose: Scans that report back through callbacks.  See scanasync.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "scanasync.h"
+#include <pthread.h>
+#include <stdlib.h>
+
+/* As many batches as primascand has */
+#define SCAN_ASYNC_BATCHES 8
+
+
+
+
+/*******************************************************************************
+ *  ScanAsync -    One scan, from scanAsync() until done has been called.
+ *                 params, firstRow, data, count - The batch posted to the
+ *                                  executor, only one at a time
+ *                 posted -         Non-zero until it has been run
+ *                 failed -         What done is told
+ ******************************************************************************/
+typedef struct ScanAsync
+{
+  Scanner *scanner;
+  int rowsPerBatch;
+  FanoutRows rows;
+  FanoutDone done;
+  void *user;
+  ScanAsyncPost post;
+  void *executor;
+
+  ScanParameters *params;
+  int firstRow;
+  const char *data;
+  int count;
+  int posted;
+  int failed;
+
+  pthread_mutex_t lock;
+  pthread_cond_t ran;
+} ScanAsync;
+
+
+
+
+/*******************************************************************************
+ *  runScan() -        The scan's thread.  Starts the scan and reads it
+ *                     through a fan-out with one subscriber.
+ *
+ *  postRows() -       The subscriber.  Calls rows, or posts runRows() and
+ *                     waits until it has run, so the batch is not reused
+ *                     under it.
+ *
+ *  runRows() -        Calls rows for the posted batch, on the executor.
+ *
+ *  runDone() -        Calls done and frees the scan.
+ ******************************************************************************/
+static void *runScan (void *arg);
+static void postRows (void *arg, ScanParameters *params, int firstRow,
+		      const char *data, int rows);
+static void runRows (void *arg);
+static void runDone (void *arg);
+
+
+
+
+int scanAsync (Scanner *scanner, int rowsPerBatch, FanoutRows rows,
+	       FanoutDone done, void *user, ScanAsyncPost post,
+	       void *executor)
+{
+  ScanAsync *scan = calloc (1, sizeof (ScanAsync));
+  pthread_attr_t attr;
+  pthread_t thread;
+  int result;
+
+  if (scan == NULL)
+    return 0;
+
+  scan->scanner = scanner;
+  scan->rowsPerBatch = rowsPerBatch;
+  scan->rows = rows;
+  scan->done = done;
+  scan->user = user;
+  scan->post = post;
+  scan->executor = executor;
+
+  pthread_mutex_init (&scan->lock, NULL);
+  pthread_cond_init (&scan->ran, NULL);
+
+  /* Nobody joins it, done is how the caller hears it finished */
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  result = pthread_create (&thread, &attr, runScan, scan);
+  pthread_attr_destroy (&attr);
+
+  if (result != 0)
+  {
+    pthread_mutex_destroy (&scan->lock);
+    pthread_cond_destroy (&scan->ran);
+    free (scan);
+    return 0;
+  }
+
+  return 1;
+}
+
+
+static void *runScan (void *arg)
+{
+  ScanAsync *scan = arg;
+  Scanner *scanner = scan->scanner;
+  ScanParameters params;
+  Fanout *fanout;
+  int status = SCANNER_ERROR;
+  int restarts = 0;
+
+  scannerGetParameters (scanner, &params);
+
+  /* About 64k per batch, like primascand */
+  if (scan->rowsPerBatch <= 0)
+    scan->rowsPerBatch = 0x10000 / params.bytesPerLine;
+
+  fanout = fanoutCreate (&params, scan->rowsPerBatch, SCAN_ASYNC_BATCHES,
+			 SPOOL_MEMORY_LIMIT);
+
+  if (fanout != NULL)
+  {
+    fanoutSubscribe (fanout, postRows, NULL, scan);
+
+    /* Nothing has been read yet, so starting over is safe */
+    while ((status = scannerStart (scanner)) != SCANNER_GOOD)
+    {
+      if (restarts++ == SCANNER_MAX_RESTARTS || !scannerRecover (scanner))
+	break;
+    }
+
+    if (status == SCANNER_GOOD)
+      status = fanoutRun (fanout, scanner);
+    else
+      status = SCANNER_ERROR;
+
+    fanoutDestroy (fanout);
+  }
+
+  /* The scanner is the caller's again once done is called */
+  if (status != SCANNER_EOF)
+    scannerRecover (scanner);
+
+  scan->failed = (status != SCANNER_EOF);
+
+  if (scan->post != NULL)
+    scan->post (scan->executor, runDone, scan);
+  else
+    runDone (scan);
+
+  return NULL;
+}
+
+
+static void postRows (void *arg, ScanParameters *params, int firstRow,
+		      const char *data, int rows)
+{
+  ScanAsync *scan = arg;
+
+  if (scan->post == NULL)
+  {
+    scan->rows (scan->user, params, firstRow, data, rows);
+    return;
+  }
+
+  scan->params = params;
+  scan->firstRow = firstRow;
+  scan->data = data;
+  scan->count = rows;
+  scan->posted = 1;
+
+  scan->post (scan->executor, runRows, scan);
+
+  pthread_mutex_lock (&scan->lock);
+
+  while (scan->posted)
+    pthread_cond_wait (&scan->ran, &scan->lock);
+
+  pthread_mutex_unlock (&scan->lock);
+}
+
+
+static void runRows (void *arg)
+{
+  ScanAsync *scan = arg;
+
+  scan->rows (scan->user, scan->params, scan->firstRow, scan->data,
+	      scan->count);
+
+  pthread_mutex_lock (&scan->lock);
+  scan->posted = 0;
+  pthread_cond_signal (&scan->ran);
+  pthread_mutex_unlock (&scan->lock);
+}
+
+
+static void runDone (void *arg)
+{
+  ScanAsync *scan = arg;
+
+  scan->done (scan->user, scan->failed);
+
+  pthread_mutex_destroy (&scan->lock);
+  pthread_cond_destroy (&scan->ran);
+  free (scan);
+}
@@ -0,0 +1,61 @@
+/*******************************************************************************
+ *  scanasync.h
+ *
+ *  Purpose: Scans without a thread of the caller's waiting for them, for
+ *           event-driven programs that run many scanners from one loop.
+ *           scanAsync() returns at once; the rows arrive in batches of
+ *           whole rows as they are read, and a last callback says the scan
+ *           is over.
+ *
+ *           The callbacks run on a thread of the scan's own unless an
+ *           executor is given.  Then each one is handed to post() instead,
+ *           to run wherever the executor runs things, such as the event
+ *           loop's thread.  The batch stays valid until the rows callback
+ *           has run.  Meanwhile the scanner carries on into the spool, so
+ *           a busy loop does not hold it up.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef SCANASYNC_H
+#define SCANASYNC_H
+
+#include "fanout.h"
+
+
+
+
+/*******************************************************************************
+ *  ScanAsyncPost - Asks executor to call run (arg) soon, on whatever thread
+ *                 it runs things on.  It must not call it from within
+ *                 post(), and must run everything in the order posted.
+ ******************************************************************************/
+typedef void (*ScanAsyncPost) (void *executor, void (*run) (void *arg),
+			       void *arg);
+
+
+
+
+/*******************************************************************************
+ *  scanAsync() -      Starts a scan of scanner at scanner->dpiValue, which
+ *                     must not be used for anything else until done has
+ *                     been called.  Initialize Scanner is run first if the
+ *                     scanner is not warm yet.
+ *
+ *                     rows is called with each batch of up to rowsPerBatch
+ *                     rows (0 for about 64k), in order, as for fanout.h.
+ *                     Then done is called once; failed is non-zero if the
+ *                     scan did not complete, and the scanner has been
+ *                     recovered if it could be.  With post NULL both are
+ *                     called on the scan's thread.
+ *
+ *                     Returns 0 if the scan could not be started, and no
+ *                     callback will be called then.
+ ******************************************************************************/
+int scanAsync (Scanner *scanner, int rowsPerBatch, FanoutRows rows,
+	       FanoutDone done, void *user, ScanAsyncPost post,
+	       void *executor);
+
+#endif
@@ -0,0 +1,239 @@
+/*******************************************************************************
+ *  scanbench.c
+ *
+ *  Purpose: Times whole scans, the way a user would see them, so different
+ *           designs of the engine can be compared without a scanner.
+ *           'make bench-scan' builds and runs it.
+ *
+ *           scanbench [-n runs] [-c command]
+ *
+ *           Runs command (./primascan by default) runs times (default 3)
+ *           for a color and for a text scan and reads the image from its
+ *           stdout.  That covers everything from sane_init() to
+ *           sane_close().  For every run it prints
+ *
+ *             ttfb_ms -   From starting the command to the first image
+ *                         byte arriving
+ *             total_ms -  From starting the command to its exit
+ *             cpu_ms -    User and system time the command used
+ *             rss_kb -    Its peak resident set size
+ *             bytes -     How much image it wrote
+ *
+ *           and then the median of each.  Unless they are set already,
+ *           PRIMASCAN_TRANSPORT is set to sim and PRIMASCAN_SIM_TIMING to
+ *           usb, so the simulated scanner takes about as long as a real
+ *           one (see simtransport.c).  Point PRIMASCAN_SIM_TIMING at
+ *           spike4.pl output to replay the timing of a real scan.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MAX_RUNS 100
+
+
+
+
+/*******************************************************************************
+ *  Run -          What one scan measured.
+ ******************************************************************************/
+typedef struct Run
+{
+  double ttfbMs;
+  double totalMs;
+  double cpuMs;
+  long rssKb;
+  long bytes;
+} Run;
+
+
+
+
+/*******************************************************************************
+ *  runScan() -        Runs command once with the given mode argument (NULL
+ *                     for color) and fills in run.  Returns 0 if the scan
+ *                     failed.
+ *
+ *  median() -         The median of count values.  Sorts them.
+ *
+ *  compareDoubles() - For qsort().
+ *
+ *  elapsedMs() -      Milliseconds between two times.
+ ******************************************************************************/
+static int runScan (const char *command, const char *mode, Run *run);
+static double median (double *values, int count);
+static int compareDoubles (const void *a, const void *b);
+static double elapsedMs (struct timespec *from, struct timespec *to);
+
+
+
+
+int main (int argc, char *argv[])
+{
+  static const char *modes[] = { "color", "text" };
+  const char *command = "./primascan";
+  Run runs[MAX_RUNS];
+  double values[MAX_RUNS];
+  int count = 3;
+  int i;
+  int m;
+
+  for (i = 1; i + 1 < argc; i += 2)
+  {
+    if (!strcmp (argv[i], "-n"))
+      count = atoi (argv[i + 1]);
+    else if (!strcmp (argv[i], "-c"))
+      command = argv[i + 1];
+  }
+
+  if (count < 1 || count > MAX_RUNS)
+  {
+    fprintf (stderr, "runs must be between 1 and %d\n", MAX_RUNS);
+    return 1;
+  }
+
+  setenv ("PRIMASCAN_TRANSPORT", "sim", 0);
+  setenv ("PRIMASCAN_SIM_TIMING", "usb", 0);
+
+  printf ("%s, sim timing %s\n", command, getenv ("PRIMASCAN_SIM_TIMING"));
+
+  for (m = 0; m < 2; m++)
+  {
+    for (i = 0; i < count; i++)
+    {
+      if (!runScan (command, m ? modes[m] : NULL, &runs[i]))
+      {
+	fprintf (stderr, "%s scan %d failed\n", modes[m], i + 1);
+	return 1;
+      }
+
+      printf ("%-5s run %-3d ttfb_ms=%.1f total_ms=%.1f cpu_ms=%.1f "
+	      "rss_kb=%ld bytes=%ld\n", modes[m], i + 1, runs[i].ttfbMs,
+	      runs[i].totalMs, runs[i].cpuMs, runs[i].rssKb, runs[i].bytes);
+    }
+
+    printf ("%-5s median  ", modes[m]);
+
+    for (i = 0; i < count; i++)
+      values[i] = runs[i].ttfbMs;
+
+    printf ("ttfb_ms=%.1f ", median (values, count));
+
+    for (i = 0; i < count; i++)
+      values[i] = runs[i].totalMs;
+
+    printf ("total_ms=%.1f ", median (values, count));
+
+    for (i = 0; i < count; i++)
+      values[i] = runs[i].cpuMs;
+
+    printf ("cpu_ms=%.1f ", median (values, count));
+
+    for (i = 0; i < count; i++)
+      values[i] = runs[i].rssKb;
+
+    printf ("rss_kb=%.0f\n", median (values, count));
+  }
+
+  return 0;
+}
+
+
+static int runScan (const char *command, const char *mode, Run *run)
+{
+  struct timespec start;
+  struct timespec now;
+  struct rusage usage;
+  char buffer[0x10000];
+  int pipeFds[2];
+  int status;
+  int length;
+  pid_t pid;
+
+  memset (run, 0, sizeof (Run));
+
+  if (pipe (pipeFds) < 0)
+    return 0;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  pid = fork ();
+
+  if (pid < 0)
+    return 0;
+
+  if (pid == 0)
+  {
+    int devNull = open ("/dev/null", O_WRONLY);
+
+    dup2 (pipeFds[1], STDOUT_FILENO);
+    dup2 (devNull, STDERR_FILENO);
+    close (pipeFds[0]);
+    close (pipeFds[1]);
+
+    execl (command, command, mode, (char *) NULL);
+    _exit (127);
+  }
+
+  close (pipeFds[1]);
+
+  while ((length = read (pipeFds[0], buffer, sizeof (buffer))) > 0)
+  {
+    if (run->bytes == 0)
+    {
+      clock_gettime (CLOCK_MONOTONIC, &now);
+      run->ttfbMs = elapsedMs (&start, &now);
+    }
+
+    run->bytes += length;
+  }
+
+  close (pipeFds[0]);
+
+  if (wait4 (pid, &status, 0, &usage) < 0)
+    return 0;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  run->totalMs = elapsedMs (&start, &now);
+  run->cpuMs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+    (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+  run->rssKb = usage.ru_maxrss;
+
+  return WIFEXITED (status) && WEXITSTATUS (status) == 0 && run->bytes > 0;
+}
+
+
+static double median (double *values, int count)
+{
+  qsort (values, count, sizeof (double), compareDoubles);
+
+  if (count % 2)
+    return values[count / 2];
+
+  return (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+
+static int compareDoubles (const void *a, const void *b)
+{
+  double difference = *(const double *) a - *(const double *) b;
+
+  return (difference > 0) - (difference < 0);
+}
+
+
+static double elapsedMs (struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) * 1000.0 +
+    (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
@@ -0,0 +1,1392 @@
+/*******************************************************************************
+ *  scanner.c
+ *
+ *  Purpose: Runs the transfer sequences that drive a Colorado 2400u.  This
+ *           was the body of sane_start() and sane_read() in primascan.c;
+ *           it works on a Scanner instead of static globals so the CLI,
+ *           the SANE frontend and the daemon can share it.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+
+
+
+
+/*******************************************************************************
+ *  Most of our transfer data is contained in primascan.h
+ *  There are several structures:
+ *  scannerSetup              - for initialization of the scanner
+ *  setupBlack and setupColor - for getting the scanner ready for a particular
+ *                              scan.
+ *  calibrationWrite          - for a specific calibration write to the scanner
+ *  scanBlack and scanColor   - for performing a particular scan
+ *  finalize                  - for finalizing the scanner
+ *
+ *  The tables are static, so primascan.h must only be included here.
+ ******************************************************************************/
+#include "primascan.h"
+#include "scanner.h"
+#include "trace.h"
+#include "profile.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+
+/*******************************************************************************
+ *  Transfer functions
+ *  ------------------
+ *
+ *  controlTransfer()- When we need to send a control transfer to the scanner
+ *                     we need information about the requestType, request,
+ *                     value, index, and size fields required by the USB
+ *                     specification.  We pass in an integer pointer where
+ *                     data[0] = requestType;
+ *                     data[1] = request;
+ *                     data[3] + data[2] = value;
+ *                     data[5] + data[4] = index;
+ *                     data[7] + data[6] = size;
+ *                     Where the '+' operator means concatenation.  This format
+ *                     follows the format of sniffusb.
+ *
+ *  reapeatedControlTransfer() - This performs a control transfer multiple
+ *                     times until the desired value is given by
+ *                     the scanner.  This is used to wait until the
+ *                     scanner is ready. The parameters are the same
+ *                     except there is an additional integer value
+ *                     that represents that value that the scan is
+ *                     waiting for in data[8].  Gives up after
+ *                     pollTimeoutMs.
+ *
+ *  bulkRead() -       Reads data from the scanner into bulkBuffer.
+ *                     data[0] = 0xfa
+ *                     data[1] = The endpoint for the bulk read
+ *                     data[3] + data[2] = The size of the read
+ *                     Short reads are continued until all of it is in.
+ *                     Returns 1 then, or 0 if the scanner stops sending;
+ *                     calling it again for the same entry carries on
+ *                     where it stopped.
+ *
+ *  writeBulk0s() -    Often the scanner requires a bulk write of nothing but
+ *                     '0's.  This function will write that to the scanner.
+ *                     data[0] = 0xff
+ *                     data[1] = The endpoint for the bulk write
+ *                     data[3] + data[2] = The size of the write
+ *
+ *  calibrationWrite() - A special calibration data set will need to be written
+ *                     to the scanner three times during a scan.  That data
+ *                     is represented by the variable calibWrite.  The
+ *                     parameter is a pointer to calibWrite.
+ *
+ *  calibrate() -      A certain sequence of calibration needs to be generated
+ *                     at certain times in the scan.  This function generates
+ *                     that sequence and sends it to the scanner.
+ *
+ *  finalizeScanner()- After reading the scanned data we need to perform a
+ *                     few more operations.  This function will run through
+ *                     those.
+ *
+ *  queuedControlTransfer() - Like controlTransfer(), but only queues an OUT
+ *                     transfer (see submitControl() in transport.h).
+ *
+ *  flushControl() -   Waits for the queued transfers.  Returns 1 if they
+ *                     all went through.  A queued transfer that failed is
+ *                     reported at the table entry that waited for it.
+ *
+ *  runTransfer() -    Runs one of the transfer functions above on a table
+ *                     entry through retryTransfer(), and profiles it.
+ *
+ *  retryTransfer() -  Runs the transfer.  If nothing at all was
+ *                     transferred, clears the halt and polls again before
+ *                     giving up (see scanner.h).
+ *
+ *  recordRecovery() - Counts a recovery at the given level and the time
+ *                     it took since scanner->failedAt.
+ *
+ *  recordedControlMsg(), recordedBulkRead(), recordedBulkWrite() -
+ *                     The transport functions of the same name, recorded
+ *                     in the flight recorder (and the trace, if on).
+ *
+ *  traceTransfer() -  Adds a transfer that just finished to the trace.
+ *
+ *  profileTransfer() - Adds the table entry that just finished to the
+ *                     profile, under the name of the table it is from.
+ *
+ *  tracePhase() -     Adds a phase of the sequence that just finished (or
+ *                     failed) to the trace.
+ *
+ *  timePhase() -      Adds how long a phase that went through took to the
+ *                     metrics.
+ *
+ *  reportError() -    Prints where in the sequence a transfer failed and
+ *                     dumps the flight recorder.
+ *
+ *  setupTransfer() -  Runs one entry of setupBlack or setupColor.  Returns
+ *                     what the transfer did; anything but 1, a short bulk
+ *                     write of zeros included, is a failure.
+ *
+ *  isDeadRead() -     Whether entry is a register read that next, the
+ *                     entry after it (NULL at the end of a table), writes
+ *                     straight back with the answer that was sniffed for
+ *                     it.  The driver that was sniffed changed nothing it
+ *                     read; the table already holds the value it wrote,
+ *                     and controlTransfer() throws what was read away.
+ *                     A read whose answer was changed before it was
+ *                     written back is kept.  deadreads.pl uses the same
+ *                     rule.
+ *
+ *  allocBulkBuffer() - Points bulkBuffer at memory from the transport's
+ *                     allocBuffer() if it has any, or at largeBuffer.
+ *
+ *  freeBulkBuffer() - Gives memory from allocBuffer() back to the
+ *                     transport, while the device is still open.
+ *
+ *  openDevice() -     Opens the scanner's device and its bulk buffer.
+ *                     Returns 0 if it is not there.
+ *
+ *  sharedSetupSize() - How many entries setupBlack and setupColor start
+ *                     with that send the scanner the same thing.  Control
+ *                     reads count as the same if the request is, since
+ *                     what the table holds for them was only what the
+ *                     sniffed scanner answered.
+ *
+ *  readImage() -      scannerRead() and scannerBorrow().  With buf NULL the
+ *                     data is not copied, *borrowed points at it instead.
+ ******************************************************************************/
+static int controlTransfer (Scanner *scanner, int *data);
+static int queuedControlTransfer (Scanner *scanner, int *data);
+static int flushControl (Scanner *scanner);
+static int repeatedControlTransfer (Scanner *scanner, int *data);
+static int bulkRead (Scanner *scanner, int *data);
+static int writeBulk0s (Scanner *scanner, int *data);
+static int calibrationWrite (Scanner *scanner, int *data);
+static int calibrate (Scanner *scanner, int *data);
+static int finalizeScanner (Scanner *scanner);
+static int runTransfer (Scanner *scanner,
+			int (*transfer) (Scanner *scanner, int *data),
+			int *data);
+static int retryTransfer (Scanner *scanner,
+			  int (*transfer) (Scanner *scanner, int *data),
+			  int *data);
+static void recordRecovery (Scanner *scanner, int level);
+static int recordedControlMsg (Scanner *scanner, int requestType,
+			       int request, int value, int index,
+			       char *buffer, int size, int timeout);
+static int recordedBulkRead (Scanner *scanner, int ep, char *buffer,
+			     int size, int timeout);
+static int recordedBulkWrite (Scanner *scanner, int ep, char *buffer,
+			      int size, int timeout);
+static void traceTransfer (Scanner *scanner, const char *name,
+			   int requestType, int request, int value, int index,
+			   int size, int result, struct timespec *start);
+static void profileTransfer (Scanner *scanner, int *data,
+			     struct timespec *start);
+static void tracePhase (Scanner *scanner, const char *name,
+			struct timespec *start, int result);
+static void timePhase (Scanner *scanner, int phase, struct timespec *start);
+static void reportError (Scanner *scanner, const char *phase, int urb,
+			 int line);
+static double elapsedMs (struct timespec *from, struct timespec *to);
+static int setupTransfer (Scanner *scanner, int *entry);
+static int isDeadRead (int *entry, int *next);
+static int sharedSetupSize (void);
+static void allocBulkBuffer (Scanner *scanner);
+static void freeBulkBuffer (Scanner *scanner);
+static int openDevice (Scanner *scanner);
+static int readImage (Scanner *scanner, char *buf, const char **borrowed,
+		      int max_len, int *len);
+
+
+
+
+int scannerOpen (Scanner *scanner, const Transport *transport, int index)
+{
+  memset (scanner, 0, sizeof (Scanner));
+
+  scanner->transport = transport;
+  scanner->index = index;
+  scanner->dpiValue = 100;
+  scanner->pollTimeoutMs = SCANNER_POLL_TIMEOUT_MS;
+  scanner->queueControl = transport->submitControl != NULL;
+  flightInit (&scanner->flight, index);
+  metricsInit (&scanner->metrics, index);
+
+  return openDevice (scanner);
+}
+
+void scannerClose (Scanner *scanner)
+{
+  /* Close any open device */
+  if (scanner->isDeviceOpen)
+  {
+    freeBulkBuffer (scanner);
+    scanner->transport->close (scanner->device);
+    scanner->isDeviceOpen = 0;
+    scanner->isWarm = 0;
+    scanner->setupSent = 0;
+  }
+}
+
+int scannerWarmUp (Scanner *scanner)
+{
+  struct timespec phaseStart;
+  int i;
+  int result;
+
+  /* A recovery that could not open it again left the scanner closed */
+  if (!scanner->isDeviceOpen && !openDevice (scanner))
+    return SCANNER_ERROR;
+
+  clock_gettime (CLOCK_MONOTONIC, &phaseStart);
+
+  /*********************************
+   * Initialize scanner
+   ********************************/
+  scanner->flight.phase = FLIGHT_PHASE_INITIALIZE;
+
+  for (i = 0; i < scannerSetupSize; i++)
+  {
+    scanner->flight.tableIndex = i;
+
+    if (scanner->skipDeadReads &&
+	isDeadRead (scannerSetup[i],
+		    i + 1 < scannerSetupSize ? scannerSetup[i + 1] : NULL))
+      continue;
+    result = runTransfer (scanner, controlTransfer, scannerSetup[i]);
+
+    if (result != 1)
+    {
+      reportError (scanner, "Initialize Scanner", i, i);
+      tracePhase (scanner, "Initialize Scanner", &phaseStart, 0);
+      return SCANNER_ERROR;
+    }
+  }
+
+  timePhase (scanner, FLIGHT_PHASE_INITIALIZE, &phaseStart);
+  tracePhase (scanner, "Initialize Scanner", &phaseStart, 1);
+  scanner->isWarm = 1;
+  scanner->setupSent = 0;
+
+  return scannerPrime (scanner);
+}
+
+int scannerPrime (Scanner *scanner)
+{
+  struct timespec phaseStart;
+  int shared = sharedSetupSize ();
+  int i;
+
+  if (scanner->setupSent == shared)
+    return SCANNER_GOOD;
+
+  if (!scanner->isDeviceOpen)
+    return SCANNER_ERROR;
+
+  /* Either table will do, they are the same this far */
+  scanner->flight.phase = FLIGHT_PHASE_SETUP;
+  clock_gettime (CLOCK_MONOTONIC, &phaseStart);
+
+  for (i = scanner->setupSent; i < shared; i++)
+  {
+    scanner->flight.tableIndex = i;
+
+    if (scanner->skipDeadReads &&
+	isDeadRead (setupColor[i], setupColor[i + 1]))
+    {
+      scanner->setupSent = i + 1;
+      continue;
+    }
+
+    if (setupTransfer (scanner, setupColor[i]) != 1)
+    {
+      flushControl (scanner);
+      reportError (scanner, "Shared Setup", i + 78, i);
+      tracePhase (scanner, "Shared Setup", &phaseStart, 0);
+      scanner->setupSent = 0;
+      return SCANNER_ERROR;
+    }
+
+    scanner->setupSent = i + 1;
+  }
+
+  if (!flushControl (scanner))
+  {
+    reportError (scanner, "Shared Setup", i + 78, i);
+    tracePhase (scanner, "Shared Setup", &phaseStart, 0);
+    scanner->setupSent = 0;
+    return SCANNER_ERROR;
+  }
+
+  tracePhase (scanner, "Shared Setup", &phaseStart, 1);
+  return SCANNER_GOOD;
+}
+
+int scannerStart (Scanner *scanner)
+{
+  struct timespec phaseStart;
+  int i;
+  int result;
+
+  /* Nothing is left over from a scan that was abandoned */
+  scanner->bulkEntry = NULL;
+
+  if (!scanner->isWarm && !scannerWarmUp (scanner))
+    return SCANNER_ERROR;
+
+
+  /*******************************
+   * Scanner Setup
+   ******************************/
+  int *typePtr;
+  int typeSize;
+
+  /* Setup is different for black or for color */
+  if (scanner->dpiValue == 200)
+  {
+    typePtr = setupBlack[0];
+    typeSize = setupBlackSize;
+  }
+  else
+  {
+    typePtr = setupColor[0];
+    typeSize = setupColorSize;
+  }
+
+
+  scanner->flight.phase = FLIGHT_PHASE_SETUP;
+
+  clock_gettime (CLOCK_MONOTONIC, &phaseStart);
+
+  /* What scannerPrime() sent already is not sent again */
+  i = scanner->setupSent;
+  scanner->setupSent = 0;
+
+  for (; i < typeSize; i++)
+  {
+    scanner->flight.tableIndex = i;
+
+    if (scanner->skipDeadReads &&
+	isDeadRead (typePtr + (i * 16),
+		    i + 1 < typeSize ? typePtr + ((i + 1) * 16) : NULL))
+      continue;
+
+    if (setupTransfer (scanner, typePtr + (i * 16)) != 1)
+    {
+      flushControl (scanner);
+      reportError (scanner, "Scanner Setup", i + 78, i);
+      tracePhase (scanner, "Scanner Setup", &phaseStart, 0);
+      return SCANNER_ERROR;
+    }
+  }
+
+  /* The last writes may still be on their way */
+  if (!flushControl (scanner))
+  {
+    reportError (scanner, "Scanner Setup", i + 78, i);
+    tracePhase (scanner, "Scanner Setup", &phaseStart, 0);
+    return SCANNER_ERROR;
+  }
+
+  timePhase (scanner, FLIGHT_PHASE_SETUP, &phaseStart);
+  tracePhase (scanner, "Scanner Setup", &phaseStart, 1);
+
+
+  /****************************
+   * Scanner Calibration
+   ***************************/
+
+  scanner->flight.phase = FLIGHT_PHASE_CALIBRATION;
+
+  clock_gettime (CLOCK_MONOTONIC, &phaseStart);
+
+  for (i = 0; i < calibrationSize; i++)
+  {
+    scanner->flight.tableIndex = i;
+
+    if (calibration[i][0] == 0xfc)
+    {
+      /* If we need to do the special calibration */
+      result = runTransfer (scanner, calibrationWrite, calibration[i]);
+    }
+    else if (calibration[i][0] == 0xfd)
+    {
+      /* If we need a calculated calibration */
+      result = runTransfer (scanner, calibrate, calibration[i]);
+    }
+    else
+    {
+      /* Normal control transfer */
+      result = runTransfer (scanner, controlTransfer, calibration[i]);
+    }
+
+    /* If there's a problem anywhere */
+    if (result != 1)
+    {
+      if (scanner->dpiValue == 200)
+	reportError (scanner, "Scanner Calibration", i + 905, i);
+      else
+	reportError (scanner, "Scanner Calibration", i + 1056, i);
+
+      tracePhase (scanner, "Scanner Calibration", &phaseStart, 0);
+      return SCANNER_ERROR;
+    }
+  }
+
+  timePhase (scanner, FLIGHT_PHASE_CALIBRATION, &phaseStart);
+  tracePhase (scanner, "Scanner Calibration", &phaseStart, 1);
+
+  /* The scanner is now ready for the actual scan */
+  scanner->readIndex = 0;
+  scanner->dataAvailable = 0;
+  scanner->whereInBuffer = 0;
+  clock_gettime (CLOCK_MONOTONIC, &scanner->scanStarted);
+
+  return SCANNER_GOOD;
+}
+
+
+int scannerRead (Scanner *scanner, char *buf, int max_len, int *len)
+{
+  return readImage (scanner, buf, NULL, max_len, len);
+}
+
+int scannerBorrow (Scanner *scanner, const char **data, int max_len, int *len)
+{
+  return readImage (scanner, NULL, data, max_len, len);
+}
+
+static int readImage (Scanner *scanner, char *buf, const char **borrowed,
+		      int max_len, int *len)
+{
+  int *typePtr;
+  int typeSize;
+  int result;
+  int i;
+
+  *len = 0;
+
+  /* The scan is different for black or for color */
+  if (scanner->dpiValue == 200)
+  {
+    typePtr = scanBlack[0];
+    typeSize = scanBlackSize;
+  }
+  else
+  {
+    typePtr = scanColor[0];
+    typeSize = scanColorSize;
+  }
+
+  /* Pick up where the last call left off */
+  for (i = scanner->readIndex; i < typeSize; i++)
+  {
+    /*
+     * If we didn't finish giving all of our data to the function
+     * last time because the buffer was too small, do it now.
+     */
+
+    if (scanner->dataAvailable > 0)
+    {
+      char *largeBuffer = scanner->bulkBuffer;
+      int whereInBuffer = scanner->whereInBuffer;
+
+      /* Borrowed data stays where it is until the next bulk read */
+      if (buf == NULL)
+	*borrowed = largeBuffer + whereInBuffer;
+
+      if (scanner->dataAvailable < max_len)
+      {
+	/* copy available data to buffer */
+	if (buf != NULL)
+	  scannerCopyData (buf, largeBuffer + whereInBuffer,
+			   scanner->dataAvailable);
+
+	*len = scanner->dataAvailable;
+	scanner->dataAvailable = 0;
+	scanner->whereInBuffer = 0;
+      }
+      else
+      {
+	/* copy available data up to max_len */
+	if (buf != NULL)
+	  scannerCopyData (buf, largeBuffer + whereInBuffer, max_len);
+
+	*len = max_len;
+	scanner->dataAvailable -= max_len;
+	scanner->whereInBuffer += max_len;
+      }
+
+      scanner->readIndex = i;
+      return SCANNER_GOOD;
+    }
+
+
+    /* If we have no data left we need to get more */
+    scanner->flight.phase = FLIGHT_PHASE_SCAN;
+    scanner->flight.tableIndex = i;
+
+    if (*(typePtr + (i * 16)) == 0xfa)
+    {
+      /* Bulk read */
+      result = runTransfer (scanner, bulkRead, typePtr + (i * 16));
+      scanner->dataAvailable = scanner->bulkLength;
+      scanner->whereInBuffer = 0;
+    }
+    else
+    {
+      /* Control Transfer */
+      result = runTransfer (scanner, controlTransfer, typePtr + (i * 16));
+    }
+
+    /* If something went wrong */
+    if (result != 1)
+    {
+      if (scanner->dpiValue == 200)
+	reportError (scanner, "Scanner Calibration", i + 936, i);
+      else
+	reportError (scanner, "Scanner Calibration", i + 1114, i);
+
+      scanner->readIndex = i;
+      return SCANNER_ERROR;
+    }
+  }
+
+  /* The scan has already been finished */
+  if (scanner->readIndex > typeSize)
+    return SCANNER_EOF;
+
+  timePhase (scanner, FLIGHT_PHASE_SCAN, &scanner->scanStarted);
+
+  /* After scan, make sure to run remaining transfers */
+  if (!finalizeScanner (scanner))
+    return SCANNER_ERROR;
+
+  scanner->readIndex = typeSize + 1;
+  scanner->restarts = 0;
+  return SCANNER_EOF;
+}
+
+
+void scannerGetParameters (Scanner *scanner, ScanParameters *params)
+{
+  /* Black and white scan */
+  if (scanner->dpiValue == 200)
+  {
+    params->format = SCAN_FORMAT_GRAY;
+    params->lines = 2342;
+    params->depth = 1;
+    params->pixelsPerLine = 1656;
+    params->bytesPerLine = 207;
+  }
+  /* Color scan */
+  else
+  {
+    params->format = SCAN_FORMAT_RGB;
+    params->lines = 1221;
+    params->depth = 8;
+    params->pixelsPerLine = 826;
+    params->bytesPerLine = 2478;
+  }
+}
+
+
+int scannerRecover (Scanner *scanner)
+{
+  int level = SCANNER_RECOVER_FINALIZE;
+  int result;
+
+  if (scanner->failedAt.tv_sec == 0)
+    clock_gettime (CLOCK_MONOTONIC, &scanner->failedAt);
+
+  /* If finalizing did not help last time, go straight to the reset */
+  if (scanner->restarts++ > 0)
+    level = SCANNER_RECOVER_RESET;
+
+  scanner->isWarm = 0;
+  scanner->bulkEntry = NULL;
+
+  if (level == SCANNER_RECOVER_FINALIZE &&
+      finalizeScanner (scanner) && scannerWarmUp (scanner))
+  {
+    recordRecovery (scanner, level);
+    return 1;
+  }
+
+  level = SCANNER_RECOVER_RESET;
+
+  if (scanner->isDeviceOpen)
+  {
+    struct timespec start;
+
+    scanner->flight.phase = FLIGHT_PHASE_RECOVER;
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    result = scanner->transport->reset (scanner->device);
+    flightRecord (&scanner->flight, FLIGHT_RESET, 0, 0, 0, 0, NULL, 0,
+		  result, &start);
+
+    /* A failed reset may have left nothing to talk to */
+    if (result >= 0 && scannerWarmUp (scanner))
+    {
+      recordRecovery (scanner, level);
+      return 1;
+    }
+
+    /* The reset was not enough, open it from scratch */
+    freeBulkBuffer (scanner);
+    scanner->transport->close (scanner->device);
+    scanner->isDeviceOpen = 0;
+    scanner->queuedTransfers = 0;
+  }
+
+  if (openDevice (scanner) && scannerWarmUp (scanner))
+  {
+    recordRecovery (scanner, level);
+    return 1;
+  }
+
+  fprintf (stderr, "Scanner %d could not be recovered\n", scanner->index);
+
+  if (flightDump (&scanner->flight))
+    fprintf (stderr, "Last transfers written to %s\n", scanner->flight.path);
+
+  scanner->unrecovered++;
+  metricsCount (&scanner->metrics.unrecovered, 1);
+  scanner->failedAt.tv_sec = 0;
+  return 0;
+}
+
+
+void scannerCopyData (char *to, const char *from, int length)
+{
+  int j;
+
+  for (j = 0; j < length; ++j)
+    to[j] = from[j];
+}
+
+void scannerMarshal (char *buffer, const int *data, int size)
+{
+  int i;
+
+  for (i = 0; i < size; ++i)
+    buffer[i] = (char) data[i];
+}
+
+
+/****************************************************************
+ *  Transfer functions  (Defined above)
+ ****************************************************************/
+static int finalizeScanner (Scanner *scanner)
+{
+  struct timespec phaseStart;
+  int i;
+  int result;
+
+  scanner->flight.phase = FLIGHT_PHASE_FINALIZE;
+
+  clock_gettime (CLOCK_MONOTONIC, &phaseStart);
+
+  for (i = 0; i < finalizeSize; i++)
+  {
+    scanner->flight.tableIndex = i;
+
+    /* Perform the transfers */
+    result = runTransfer (scanner, controlTransfer, finalize[i]);
+
+    /* If there was a problem */
+    if (result != 1)
+    {
+      if (scanner->dpiValue == 200)
+	reportError (scanner, "Finalize Scanner", i + 1071, i);
+      else
+	reportError (scanner, "Finalize Scanner", i + 1384, i);
+
+      tracePhase (scanner, "Finalize Scanner", &phaseStart, 0);
+      return 0;
+    }
+  }
+
+  timePhase (scanner, FLIGHT_PHASE_FINALIZE, &phaseStart);
+  tracePhase (scanner, "Finalize Scanner", &phaseStart, 1);
+  return 1;
+}
+
+
+static int calibrate (Scanner *scanner, int *data)
+{
+  int ep = 2;
+  int size = 0xc000;
+  int result;
+
+  char *buffer;
+  buffer = scanner->largeBuffer;
+
+  char temp;
+  int incr = 0;
+  int i;
+  int j;
+
+  /* Get the calibration info ready */
+  for (i = 0; i < size; i += 64)
+  {
+    temp = (char) incr;
+
+    for (j = 0; j < 64; ++j)
+    {
+      buffer[j + i] = temp;
+    }
+
+    incr++;
+
+    if (incr > 0xff)
+      incr = 0;
+
+  }
+
+  /* Send calibration data to the scanner */
+  result = recordedBulkWrite (scanner, ep, buffer, size, 100);
+
+
+  if (result > 0)
+  {
+    /* If the same size, we wrote all of the data */
+    /* If not, we only wrote some of the data     */
+    if (result == size)
+      return 1;
+    else
+      return 2;
+  }
+  else
+  {
+    /* Nothing written */
+    return 0;
+  }
+}
+
+
+static int calibrationWrite (Scanner *scanner, int *data)
+{
+  /* This is a bulk write with specific data      */
+  /* We complete the transfer by adding all zeros */
+  /* Size needs to be 0x3000                      */
+
+  int ep;
+  int size;
+  int j;
+  int result;
+
+  ep = data[1];
+  size = (data[2] << 8) + data[3];
+
+  char *buffer;
+  buffer = scanner->largeBuffer;
+
+  /* Zero out the buffer */
+  for (j = 0; j < 0x3000; j++)
+    buffer[j] = 0;
+
+  /* Transfer write data to buffer */
+  scannerMarshal (buffer, calibWrite, calibWriteSize);
+
+  /* Perform bulk write */
+  result = recordedBulkWrite (scanner, ep, buffer, size, 100);
+
+  if (result > 0)
+  {
+    /* If the same size, we wrote all of the data */
+    /* If not, we only wrote some of the data     */
+    if (result == size)
+    {
+      return 1;
+    }
+    else
+    {
+      return 2;
+    }
+  }
+  else
+  {
+    /* Nothing written */
+    return 0;
+  }
+}
+
+
+static int repeatedControlTransfer (Scanner *scanner, int *data)
+{
+  int requestType;
+  int request;
+  int value;
+  int index;
+  int size;
+  char checkCharacter;
+  int result;
+  int polls;
+  struct timespec start;
+  struct timespec now;
+
+  /* determine data */
+  requestType = data[1];
+  request = data[2];
+  value = (data[4] << 8) + data[3];
+  index = (data[6] << 8) + data[5];
+  size = (data[8] << 8) + data[7];
+
+  char *buffer;
+  buffer = scanner->largeBuffer;
+
+  checkCharacter = (char) data[9];
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  polls = 0;
+
+  /* as soon as the scanner is ready, break the loop */
+  do
+  {
+    /* The watchdog: a scanner that never gets ready has hung */
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    if (elapsedMs (&start, &now) > scanner->pollTimeoutMs)
+    {
+      tracePhase (scanner, "poll", &start, 0);
+      return 0;
+    }
+
+    polls++;
+    metricsCount (&scanner->metrics.polls, 1);
+
+    /* Like controlTransfer(), start from the response we are expecting */
+    buffer[0] = checkCharacter;
+
+    result = recordedControlMsg (scanner, requestType, request, value,
+				 index, buffer, size, 300);
+
+    if (result < 0)
+    {
+      /* Error somewhere */
+      tracePhase (scanner, "poll", &start, 0);
+      return 0;
+    }
+  }
+  while (result < 1 ||
+	 ((int) buffer[0] & 0xff) != ((int) checkCharacter & 0xff));
+
+  tracePhase (scanner, "poll", &start, polls);
+  scanner->lastPoll = data;
+  return 1;
+}
+
+static int bulkRead (Scanner *scanner, int *data)
+{
+  int ep;
+  int size;
+  int result;
+
+  ep = data[1];
+  size = (data[2] << 8) + data[3];
+
+  char *buffer;
+  buffer = scanner->bulkBuffer;
+
+  /* A new chunk, unless we are retrying one that stopped part way */
+  if (scanner->bulkEntry != data)
+  {
+    scanner->bulkEntry = data;
+    scanner->bulkLength = 0;
+  }
+
+  while (scanner->bulkLength < size)
+  {
+    /* This timeout may need to be set higher than 2000 */
+    result = recordedBulkRead (scanner, ep, buffer + scanner->bulkLength,
+			       size - scanner->bulkLength, 2000);
+
+    /* No data read */
+    if (result <= 0)
+      return 0;
+
+    /* We only read some of the data, go back for the rest */
+    if (scanner->bulkLength + result < size)
+      scanner->shortReads++;
+
+    scanner->bulkLength += result;
+  }
+
+  scanner->bulkEntry = NULL;
+  return 1;
+}
+
+
+static int writeBulk0s (Scanner *scanner, int *data)
+{
+  int ep;
+  int size;
+  int i;
+  int result;
+
+  ep = data[1];
+  size = (data[2] << 8) + data[1];
+
+  char *buffer;
+  buffer = scanner->largeBuffer;
+
+  /* We can just overwrite largeBuffer because there is nothing */
+  /*  of value there yet.                                       */
+  for (i = 0; i <= size; ++i)
+    buffer[i] = 0;
+
+  /* Perform the write */
+  result = recordedBulkWrite (scanner, ep, buffer, size, 100);
+
+  if (result > 0)
+  {
+    /* If the same size, we read all of the data */
+    /* If not, we only read some of the data     */
+    if (result == size)
+      return 1;
+    else
+      return 2;
+  }
+  else
+  {
+    /* Nothing written */
+    return 0;
+  }
+}
+
+static int setupTransfer (Scanner *scanner, int *entry)
+{
+  /*
+   * There are several types of transfers:
+   *
+   *   -Bulk Read                  - represented by 0xfa
+   *   -Repeated Control Transfers - represented by 0xfb
+   *   -Write Bulk 0s              - represented by 0xff
+   *   -Anything else              - regular Control Transfer
+   */
+
+  /* Writes go straight on, only what comes back has to wait for them */
+  if (scanner->queueControl && !(entry[0] & 0x80))
+    return runTransfer (scanner, queuedControlTransfer, entry);
+
+  if (!flushControl (scanner))
+    return 0;
+
+  if (entry[0] == 0xfa)
+  {
+    /* Bulk Read */
+    return runTransfer (scanner, bulkRead, entry);
+  }
+  else if (entry[0] == 0xfb)
+  {
+    /* Repeat Command */
+    return runTransfer (scanner, repeatedControlTransfer, entry);
+  }
+  else if (entry[0] == 0xff)
+  {
+    /* Bulk write 0s */
+    return runTransfer (scanner, writeBulk0s, entry);
+  }
+
+  /* Normal Control Transfer */
+  return runTransfer (scanner, controlTransfer, entry);
+}
+
+
+static int isDeadRead (int *entry, int *next)
+{
+  /*
+   * 0xc0 0x0c reads register data[3] and was answered data[8], 0x40 0x04
+   * writes register data[8] with data[9]
+   */
+  return next != NULL && entry[0] == 0xc0 && entry[1] == 0x0c &&
+    next[0] == 0x40 && next[1] == 0x04 && next[4] == entry[4] &&
+    next[5] == entry[5] && next[8] == entry[3] && next[9] == entry[8];
+}
+
+
+static void allocBulkBuffer (Scanner *scanner)
+{
+  scanner->bulkBuffer = NULL;
+
+  if (scanner->transport->allocBuffer != NULL)
+    scanner->bulkBuffer =
+      scanner->transport->allocBuffer (scanner->device,
+				       sizeof (scanner->largeBuffer));
+
+  if (scanner->bulkBuffer == NULL)
+    scanner->bulkBuffer = scanner->largeBuffer;
+}
+
+
+static void freeBulkBuffer (Scanner *scanner)
+{
+  if (scanner->bulkBuffer != scanner->largeBuffer &&
+      scanner->bulkBuffer != NULL)
+    scanner->transport->freeBuffer (scanner->device, scanner->bulkBuffer,
+				    sizeof (scanner->largeBuffer));
+
+  scanner->bulkBuffer = scanner->largeBuffer;
+}
+
+
+static int openDevice (Scanner *scanner)
+{
+  scanner->device = scanner->transport->open (scanner->index);
+
+  if (scanner->device == NULL)
+    return 0;
+
+  scanner->isDeviceOpen = 1;
+  allocBulkBuffer (scanner);
+  return 1;
+}
+
+
+static int sharedSetupSize (void)
+{
+  int i;
+
+  for (i = 0; i < setupBlackSize && i < setupColorSize; i++)
+  {
+    int *black = setupBlack[i];
+    int *color = setupColor[i];
+    int isControlRead = black[0] != 0xfa && black[0] != 0xfb &&
+      black[0] != 0xff && (black[0] & 0x80);
+
+    if (memcmp (black, color, (isControlRead ? 8 : 16) * sizeof (int)))
+      break;
+  }
+
+  return i;
+}
+
+
+static int queuedControlTransfer (Scanner *scanner, int *data)
+{
+  struct timespec start;
+  int requestType = data[0];
+  int request = data[1];
+  int value = (data[3] << 8) + data[2];
+  int index = (data[5] << 8) + data[4];
+  int size = (data[7] << 8) + data[6];
+  int result;
+
+  /* The transport keeps its own copy */
+  scannerMarshal (scanner->largeBuffer, data + 8, size);
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  result = scanner->transport->submitControl (scanner->device, requestType,
+					      request, value, index,
+					      scanner->largeBuffer, size, 300);
+
+  /* Recorded as if it had gone through, flushControl() finds out */
+  flightRecord (&scanner->flight, FLIGHT_CONTROL, requestType, request,
+		value, index, scanner->largeBuffer, size,
+		result < 0 ? result : size, &start);
+  metricsCount (&scanner->metrics.transfers[FLIGHT_CONTROL], 1);
+  traceTransfer (scanner, "queued control", requestType, request, value,
+		 index, size, result, &start);
+
+  if (result < 0)
+    return 0;
+
+  scanner->queuedTransfers++;
+  return 1;
+}
+
+
+static int flushControl (Scanner *scanner)
+{
+  struct timespec start;
+  int result;
+
+  if (scanner->queuedTransfers == 0)
+    return 1;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  result = scanner->transport->flush (scanner->device);
+  traceTransfer (scanner, "flush", 0, 0, 0, 0, scanner->queuedTransfers,
+		 result, &start);
+  scanner->queuedTransfers = 0;
+
+  if (result < 0)
+  {
+    metricsCount (&scanner->metrics.transferErrors, 1);
+    return 0;
+  }
+
+  return 1;
+}
+
+
+static int controlTransfer (Scanner *scanner, int *data)
+{
+  int requestType;
+  int request;
+  int value;
+  int index;
+  int size;
+  int result;
+
+  requestType = data[0];
+  request = data[1];
+  value = (data[3] << 8) + data[2];
+  index = (data[5] << 8) + data[4];
+  size = (data[7] << 8) + data[6];
+
+  /* this is where data will be read or written */
+  char *buffer = scanner->largeBuffer;
+
+  /* Get the buffers ready for the control transfer */
+  scannerMarshal (buffer, data + 8, size);
+
+  /* Perform the transfer */
+  result = recordedControlMsg (scanner, requestType, request, value, index,
+			       buffer, size, 300);
+
+  if (result < 0)
+  {
+    /* Error during the control transfer */
+    return 0;
+  }
+
+  /* Everything went as planned */
+  return 1;
+}
+
+
+static int runTransfer (Scanner *scanner,
+			int (*transfer) (Scanner *scanner, int *data),
+			int *data)
+{
+  struct timespec start;
+  int result;
+
+  if (profiling)
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+  result = retryTransfer (scanner, transfer, data);
+  profileTransfer (scanner, data, &start);
+  return result;
+}
+
+
+static int retryTransfer (Scanner *scanner,
+			  int (*transfer) (Scanner *scanner, int *data),
+			  int *data)
+{
+  int result = transfer (scanner, data);
+  int ep;
+
+  /* A short transfer is up to the caller, only nothing at all is a failure */
+  if (result != 0)
+    return result;
+
+  metricsCount (&scanner->metrics.transferErrors, 1);
+
+  /* Unless this happened while recovering from an earlier failure */
+  if (scanner->failedAt.tv_sec == 0)
+    clock_gettime (CLOCK_MONOTONIC, &scanner->failedAt);
+
+  /* 1. Bulk transfers may have stalled the endpoint */
+  if (data[0] == 0xfa || data[0] == 0xfc || data[0] == 0xfd ||
+      data[0] == 0xff)
+  {
+    struct timespec start;
+
+    ep = (data[0] == 0xfd) ? 2 : data[1];
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    result = scanner->transport->clearHalt (scanner->device, ep);
+    flightRecord (&scanner->flight, FLIGHT_CLEAR_HALT, 0, 0, 0, ep, NULL, 0,
+		  result, &start);
+
+    metricsCount (&scanner->metrics.transferRetries, 1);
+    result = transfer (scanner, data);
+
+    if (result != 0)
+    {
+      recordRecovery (scanner, SCANNER_RECOVER_CLEAR_HALT);
+      return result;
+    }
+  }
+
+  /* 2. Wait until the scanner says it is ready again (or poll again) */
+  if (data[0] != 0xfb && scanner->lastPoll != NULL &&
+      repeatedControlTransfer (scanner, scanner->lastPoll) != 1)
+    return 0;
+
+  metricsCount (&scanner->metrics.transferRetries, 1);
+  result = transfer (scanner, data);
+
+  if (result != 0)
+    recordRecovery (scanner, SCANNER_RECOVER_REPOLL);
+
+  return result;
+}
+
+
+static void recordRecovery (Scanner *scanner, int level)
+{
+  static const char *levels[] = {
+    "", "clearing the halt", "polling again", "finalizing", "resetting"
+  };
+  struct timespec now;
+  double ms;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  ms = elapsedMs (&scanner->failedAt, &now);
+
+  scanner->recoveries++;
+  scanner->recoveredBy[level]++;
+  metricsCount (&scanner->metrics.recoveries[level], 1);
+  scanner->recoveryMs += ms;
+  scanner->failedAt.tv_sec = 0;
+
+  fprintf (stderr, "Scanner %d recovered by %s in %.1f ms\n",
+	   scanner->index, levels[level], ms);
+}
+
+
+static double elapsedMs (struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) * 1000.0 +
+    (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+
+static int recordedControlMsg (Scanner *scanner, int requestType,
+			       int request, int value, int index,
+			       char *buffer, int size, int timeout)
+{
+  struct timespec start;
+  int result;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  result = scanner->transport->controlMsg (scanner->device, requestType,
+					   request, value, index, buffer,
+					   size, timeout);
+  flightRecord (&scanner->flight, FLIGHT_CONTROL, requestType, request,
+		value, index, buffer, size, result, &start);
+  metricsCount (&scanner->metrics.transfers[FLIGHT_CONTROL], 1);
+  traceTransfer (scanner, "control", requestType, request, value, index,
+		 size, result, &start);
+
+  return result;
+}
+
+
+static int recordedBulkRead (Scanner *scanner, int ep, char *buffer,
+			     int size, int timeout)
+{
+  struct timespec start;
+  int result;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  result = scanner->transport->bulkRead (scanner->device, ep, buffer, size,
+					 timeout);
+  flightRecord (&scanner->flight, FLIGHT_BULK_IN, 0, 0, 0, ep, buffer,
+		size, result, &start);
+  metricsCount (&scanner->metrics.transfers[FLIGHT_BULK_IN], 1);
+  traceTransfer (scanner, "bulk-in", 0, 0, 0, ep, size, result, &start);
+
+  return result;
+}
+
+
+static int recordedBulkWrite (Scanner *scanner, int ep, char *buffer,
+			      int size, int timeout)
+{
+  struct timespec start;
+  int result;
+
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  result = scanner->transport->bulkWrite (scanner->device, ep, buffer, size,
+					  timeout);
+  flightRecord (&scanner->flight, FLIGHT_BULK_OUT, 0, 0, 0, ep, buffer,
+		size, result, &start);
+  metricsCount (&scanner->metrics.transfers[FLIGHT_BULK_OUT], 1);
+  traceTransfer (scanner, "bulk-out", 0, 0, 0, ep, size, result, &start);
+
+  return result;
+}
+
+
+static void traceTransfer (Scanner *scanner, const char *name,
+			   int requestType, int request, int value, int index,
+			   int size, int result, struct timespec *start)
+{
+  char args[160];
+
+  if (!tracing)
+    return;
+
+  snprintf (args, sizeof (args), "\"device\":%d,\"phase\":%d,"
+	    "\"line\":%d,\"request\":\"%02x %02x %04x %04x\","
+	    "\"size\":%d,\"result\":%d", scanner->index,
+	    scanner->flight.phase, scanner->flight.tableIndex, requestType,
+	    request, value, index, size, result);
+  traceComplete ("usb", name, start, args);
+}
+
+
+static void profileTransfer (Scanner *scanner, int *data,
+			     struct timespec *start)
+{
+  static const char *colorTables[] = { "open", "scannerSetup",
+    "setupColor", "calibration", "scanColor", "finalize", "recover"
+  };
+  static const char *blackTables[] = { "open", "scannerSetup",
+    "setupBlack", "calibration", "scanBlack", "finalize", "recover"
+  };
+  const char **tables = scanner->dpiValue == 200 ? blackTables : colorTables;
+
+  if (!profiling)
+    return;
+
+  profileEntry (tables[scanner->flight.phase], scanner->flight.tableIndex,
+		data, start);
+}
+
+
+static void tracePhase (Scanner *scanner, const char *name,
+			struct timespec *start, int result)
+{
+  char args[64];
+
+  if (!tracing)
+    return;
+
+  snprintf (args, sizeof (args), "\"device\":%d,\"result\":%d",
+	    scanner->index, result);
+  traceComplete ("phase", name, start, args);
+}
+
+
+static void timePhase (Scanner *scanner, int phase, struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  metricsObserve (&scanner->metrics.phaseSeconds[phase],
+		  elapsedMs (start, &now) / 1000.0);
+}
+
+
+static void reportError (Scanner *scanner, const char *phase, int urb,
+			 int line)
+{
+  fprintf (stderr, "******************\n");
+  fprintf (stderr, "Something went wrong\n");
+  fprintf (stderr, "Result not equal to 1\n");
+  fprintf (stderr, "Error in '%s'\n", phase);
+  fprintf (stderr, "Urb %d and setup line %d\n", urb, line);
+  fprintf (stderr, "******************\n");
+
+  if (flightDump (&scanner->flight))
+    fprintf (stderr, "Last transfers written to %s\n", scanner->flight.path);
+}
@@ -0,0 +1,281 @@
+/*******************************************************************************
+ *  scanner.h
+ *
+ *  Purpose: The scanner engine.  It runs the sequence tables in
+ *           primascan.h against one open Colorado 2400u.  Everything that
+ *           used to be kept in static variables in primascan.c now lives in
+ *           a Scanner, so that one process can drive several scanners at
+ *           once.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include "transport.h"
+#include "flightrec.h"
+#include "metrics.h"
+#include <time.h>
+
+
+
+
+/*******************************************************************************
+ *  Return values for scannerStart() and scannerRead()
+ ******************************************************************************/
+#define SCANNER_ERROR 0
+#define SCANNER_GOOD  1
+#define SCANNER_EOF   2
+
+
+
+
+/*******************************************************************************
+ *  Recovery
+ *
+ *  When a transfer fails, or a poll (0xfb) does not see the value it is
+ *  waiting for within pollTimeoutMs, the engine tries to get the scanner
+ *  going again, cheapest first:
+ *
+ *  SCANNER_RECOVER_CLEAR_HALT - Clear a stall on the bulk endpoint and
+ *                               retry the transfer.
+ *  SCANNER_RECOVER_REPOLL -     Poll again until the scanner is ready and
+ *                               retry the transfer.
+ *
+ *  Both happen inside the transfer, so the scan carries on as if nothing
+ *  had happened.  If they do not help, the call fails and the caller can
+ *  use scannerRecover(), which puts the scanner back in a known state so
+ *  the job can be started again:
+ *
+ *  SCANNER_RECOVER_FINALIZE -   Run finalize and Initialize Scanner.
+ *  SCANNER_RECOVER_RESET -      Reset the USB port (reopening the device
+ *                               if that is not enough) and initialize it.
+ *
+ *  SCANNER_POLL_TIMEOUT_MS -    The default pollTimeoutMs.
+ *  SCANNER_MAX_RESTARTS -       How many times a caller should start a job
+ *                               again before giving up on it.
+ ******************************************************************************/
+#define SCANNER_RECOVER_CLEAR_HALT 1
+#define SCANNER_RECOVER_REPOLL     2
+#define SCANNER_RECOVER_FINALIZE   3
+#define SCANNER_RECOVER_RESET      4
+
+#define SCANNER_POLL_TIMEOUT_MS 10000
+#define SCANNER_MAX_RESTARTS    2
+
+
+
+
+/*******************************************************************************
+ *  ScanParameters describes the image a scan will produce.  The fields
+ *  match SANE_Parameters.
+ *
+ *  format -        SCAN_FORMAT_GRAY (text) or SCAN_FORMAT_RGB (color)
+ *  depth -         Bits per sample.  1 for text, 8 for color.
+ ******************************************************************************/
+#define SCAN_FORMAT_GRAY 0
+#define SCAN_FORMAT_RGB  1
+
+typedef struct ScanParameters
+{
+  int format;
+  int lines;
+  int depth;
+  int pixelsPerLine;
+  int bytesPerLine;
+} ScanParameters;
+
+
+
+
+/*******************************************************************************
+ *  transport, device, index - How the scanner is reached.  device is
+ *                 whatever the transport returned from open(index).
+ *
+ *  isDeviceOpen - (0) is no, anything else is yes
+ *
+ *  isWarm -       scannerSetup has already been sent since the device was
+ *                 opened, so scannerStart() can skip it.
+ *
+ *  setupSent -    How many entries of Scanner Setup scannerPrime() has
+ *                 sent ahead of the next scannerStart().
+ *
+ *  dpiValue -     The current dpi value.  Only 100 (color) and 200
+ *                 (black/white) are allowed.
+ *
+ *  readIndex, dataAvailable, whereInBuffer -
+ *                 Where scannerRead() is in scanBlack/scanColor and in
+ *                 bulkBuffer between calls.
+ *
+ *  bulkEntry, bulkLength -
+ *                 The bulk read (table entry) in progress and how many
+ *                 bytes of it have arrived.  A bulk read that comes back
+ *                 short is continued until the whole chunk is in, even
+ *                 across a retry while recovering.
+ *
+ *  shortReads -   How many extra transfers that took.
+ *
+ *  pollTimeoutMs - How long a poll may wait for the scanner to be ready.
+ *
+ *  skipDeadReads - Leave out the IN control reads of Initialize Scanner
+ *                 and Scanner Setup that are dead: reads of a register
+ *                 that the very next transfer writes back with the
+ *                 answer that was sniffed for the read.  deadreads.pl
+ *                 lists them.  Off by
+ *                 default, as the sniffed tables cannot show that a read
+ *                 has no side effect on the scanner.
+ *
+ *  queueControl - Queue the control writes of Scanner Setup instead of
+ *                 waiting for each one, if the transport can (see
+ *                 submitControl() in transport.h).  On by default then.
+ *
+ *  queuedTransfers - How many are queued and not waited for yet.
+ *
+ *  lastPoll -     The last poll that succeeded, to repeat when recovering.
+ *
+ *  failedAt -     When the failure being recovered from happened (tv_sec
+ *                 is 0 if there is none).
+ *
+ *  restarts -     Times scannerRecover() has been called since the last
+ *                 scan that finished.  Each one starts a level higher.
+ *
+ *  recoveries, recoveredBy, unrecovered, recoveryMs -
+ *                 How often the scanner was recovered (in total and by
+ *                 each level), how often it could not be, and the total
+ *                 time from failure to recovery, for the mean time to
+ *                 recover.
+ *
+ *  scanStarted -  When scannerStart() finished, to time the scan itself.
+ *
+ *  flight -       The last transfers, for when something goes wrong (see
+ *                 flightrec.h).
+ *
+ *  metrics -      Counters and timings for monitoring (see metrics.h).
+ *                 Only the thread driving the scanner writes them.
+ *
+ *  largeBuffer -  Information that is read during a scan is kept in
+ *                 largeBuffer.  When large amounts of memory are obtained
+ *                 and released from the heap, errors occur.  This buffer
+ *                 prevents us from needing to allocate memory from the heap
+ *                 for every scan sequence.
+ *
+ *  bulkBuffer -   Where bulk reads go: memory the transport can have the
+ *                 device fill without a copy (see allocBuffer() in
+ *                 transport.h), or largeBuffer if there is none.  The
+ *                 engine has one bulk read going at a time, so it needs
+ *                 only the one.
+ ******************************************************************************/
+typedef struct Scanner
+{
+  const Transport *transport;
+  void *device;
+  int index;
+  int isDeviceOpen;
+  int isWarm;
+  int setupSent;
+  int dpiValue;
+
+  int readIndex;
+  int dataAvailable;
+  int whereInBuffer;
+
+  int *bulkEntry;
+  int bulkLength;
+  int shortReads;
+
+  int pollTimeoutMs;
+  int skipDeadReads;
+  int queueControl;
+  int queuedTransfers;
+  int *lastPoll;
+  struct timespec failedAt;
+  int restarts;
+
+  int recoveries;
+  int recoveredBy[SCANNER_RECOVER_RESET + 1];
+  int unrecovered;
+  double recoveryMs;
+
+  struct timespec scanStarted;
+  FlightRecorder flight;
+  Metrics metrics;
+
+  char largeBuffer[0xffff];
+  char *bulkBuffer;
+} Scanner;
+
+
+
+
+/*******************************************************************************
+ *  scannerOpen() -    Opens the index'th scanner on the given transport.
+ *                     Returns 1 on success and 0 if it can't be opened.
+ *
+ *  scannerClose() -   Closes the scanner if it is open.
+ *
+ *  scannerWarmUp() -  Sends scannerSetup (Initialize Scanner).  This is
+ *                     the same for every scan mode, so a scanner that stays
+ *                     open only needs it once.  Then primes the scanner.
+ *                     A scanner that scannerRecover() could not open again
+ *                     is opened first.  Returns 1 on success, 0 if it is
+ *                     still not there.
+ *
+ *  scannerPrime() -   Sends the start of Scanner Setup that is the same
+ *                     for black and for color, before the mode is known.
+ *                     The next scannerStart() carries on after it.  Does
+ *                     nothing if that was sent already.  Returns 1 on
+ *                     success.
+ *
+ *  scannerStart() -   Runs Initialize Scanner (unless already warm),
+ *                     Scanner Setup and Calibration for scanner->dpiValue.
+ *
+ *  scannerRead() -    Reads up to max_len bytes of image data into buf and
+ *                     stores the count in len.  Returns SCANNER_EOF after
+ *                     the scan is finished and finalize has been run.
+ *
+ *  scannerBorrow() -  Like scannerRead(), but instead of copying the data
+ *                     points *data at it inside the engine.  It is good
+ *                     until the next scannerRead() or scannerBorrow().
+ *
+ *  scannerGetParameters() - Describes the image for scanner->dpiValue.
+ *
+ *  scannerRecover() - After scannerStart() or scannerRead() failed, brings
+ *                     the scanner back to where scannerStart() can be run
+ *                     again.  Returns 1 if it did, 0 if the scanner could
+ *                     not be recovered.
+ *
+ *  Transfer errors are reported on stderr and SCANNER_ERROR (0) is
+ *  returned once recovery inside the transfer has failed.  It is up to the
+ *  caller whether that is fatal.
+ ******************************************************************************/
+int scannerOpen (Scanner *scanner, const Transport *transport, int index);
+void scannerClose (Scanner *scanner);
+int scannerWarmUp (Scanner *scanner);
+int scannerPrime (Scanner *scanner);
+int scannerStart (Scanner *scanner);
+int scannerRead (Scanner *scanner, char *buf, int max_len, int *len);
+int scannerBorrow (Scanner *scanner, const char **data, int max_len,
+		   int *len);
+void scannerGetParameters (Scanner *scanner, ScanParameters *params);
+int scannerRecover (Scanner *scanner);
+
+
+
+
+/*******************************************************************************
+ *  The loops that touch every byte, so bench.c can measure them on their
+ *  own.
+ *
+ *  scannerCopyData() - Copies length bytes of image data out of
+ *                     largeBuffer for scannerRead().
+ *
+ *  scannerMarshal() - Turns the ints of a sequence table entry into the
+ *                     bytes of a transfer.
+ ******************************************************************************/
+void scannerCopyData (char *to, const char *from, int length);
+void scannerMarshal (char *buffer, const int *data, int size);
+
+#endif
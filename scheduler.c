@@ -0,0 +1,385 @@
+/*******************************************************************************
+ *  scheduler.c
+ *
+ *  Purpose: Decides which queued job each idle scanner runs.  See
+ *           scheduler.h for the rules.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+
+
+/*******************************************************************************
+ *  Client -       How much service a client has had.  served only ever
+ *                 grows, so a client that goes quiet and comes back is
+ *                 brought up to the others first (see schedulerSubmit()).
+ *
+ *  DeviceState -  What the scheduler knows about one scanner.
+ *                 idle -      Waiting in schedulerNext()
+ *                 offline -   Gone away, see schedulerSetOffline()
+ *                 assigned -  The job it was just given
+ *                 lastDpi, lastFinished - The mode and end of its last
+ *                             good scan, for calibration affinity
+ *                 The rest are the numbers for schedulerPrintStats().
+ ******************************************************************************/
+typedef struct Client
+{
+  char name[32];
+  unsigned long served;
+  int queued;
+  struct Client *next;
+} Client;
+
+typedef struct DeviceState
+{
+  int idle;
+  int offline;
+  SchedulerJob *assigned;
+  pthread_cond_t wake;
+
+  int lastDpi;
+  struct timespec lastFinished;
+
+  unsigned long jobs;
+  unsigned long failed;
+  double waitTotal;
+  double waitMax;
+  double serviceTotal;
+  double serviceMax;
+} DeviceState;
+
+struct Scheduler
+{
+  pthread_mutex_t lock;
+  int deviceCount;
+  int freshSeconds;
+  DeviceState *devices;
+
+  SchedulerJob *queue;
+  int queueDepth;
+  Client *clients;
+  unsigned long sequence;
+  struct timespec created;
+};
+
+
+
+
+/*******************************************************************************
+ *  findClient() -     Finds (or adds) the Client with the given name.
+ *
+ *  dispatch() -       Gives queued jobs to idle scanners until it runs out
+ *                     of one or the other.  Called with the lock held
+ *                     whenever a job is queued or a scanner becomes idle.
+ *
+ *  pickDevice() -     The best idle scanner for a job, or -1.
+ *
+ *  seconds() -        Seconds between two times.
+ ******************************************************************************/
+static Client *findClient (Scheduler *scheduler, const char *name);
+static void dispatch (Scheduler *scheduler);
+static int pickDevice (Scheduler *scheduler, SchedulerJob *job,
+		       struct timespec *now);
+static double seconds (struct timespec *from, struct timespec *to);
+
+
+
+
+Scheduler *schedulerCreate (int deviceCount, int freshSeconds)
+{
+  Scheduler *scheduler = calloc (1, sizeof (Scheduler));
+  int i;
+
+  pthread_mutex_init (&scheduler->lock, NULL);
+  scheduler->deviceCount = deviceCount;
+  scheduler->freshSeconds = freshSeconds;
+  scheduler->devices = calloc (deviceCount, sizeof (DeviceState));
+
+  for (i = 0; i < deviceCount; i++)
+    pthread_cond_init (&scheduler->devices[i].wake, NULL);
+
+  clock_gettime (CLOCK_MONOTONIC, &scheduler->created);
+  return scheduler;
+}
+
+void schedulerSubmit (Scheduler *scheduler, SchedulerJob *job)
+{
+  SchedulerJob **tail;
+  Client *client;
+  Client *other;
+
+  pthread_mutex_lock (&scheduler->lock);
+
+  clock_gettime (CLOCK_MONOTONIC, &job->queued);
+  job->sequence = scheduler->sequence++;
+  job->next = NULL;
+
+  /*
+   * A client that had nothing queued starts level with the least served
+   * client that does, so it can't make up for lost time by starving
+   * everyone else.
+   */
+  client = findClient (scheduler, job->client);
+
+  if (client->queued == 0)
+  {
+    for (other = scheduler->clients; other; other = other->next)
+    {
+      if (other->queued > 0 && other->served > client->served)
+	client->served = other->served;
+    }
+  }
+
+  client->queued++;
+
+  /* Keep the queue in arrival order */
+  for (tail = &scheduler->queue; *tail; tail = &(*tail)->next);
+  *tail = job;
+  scheduler->queueDepth++;
+
+  dispatch (scheduler);
+  pthread_mutex_unlock (&scheduler->lock);
+}
+
+SchedulerJob *schedulerNext (Scheduler *scheduler, int device)
+{
+  DeviceState *state = &scheduler->devices[device];
+  SchedulerJob *job;
+
+  pthread_mutex_lock (&scheduler->lock);
+
+  state->idle = 1;
+  dispatch (scheduler);
+
+  while (state->assigned == NULL)
+    pthread_cond_wait (&state->wake, &scheduler->lock);
+
+  job = state->assigned;
+  state->assigned = NULL;
+
+  pthread_mutex_unlock (&scheduler->lock);
+  return job;
+}
+
+void schedulerDone (Scheduler *scheduler, int device, SchedulerJob *job,
+		    int failed)
+{
+  DeviceState *state = &scheduler->devices[device];
+  struct timespec now;
+  double wait;
+  double service;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  wait = seconds (&job->queued, &job->started);
+  service = seconds (&job->started, &now);
+
+  pthread_mutex_lock (&scheduler->lock);
+
+  state->jobs++;
+  state->waitTotal += wait;
+  state->serviceTotal += service;
+
+  if (wait > state->waitMax)
+    state->waitMax = wait;
+
+  if (service > state->serviceMax)
+    state->serviceMax = service;
+
+  /* Only a good scan leaves the scanner calibrated for that mode */
+  if (failed)
+  {
+    state->failed++;
+    state->lastDpi = 0;
+  }
+  else
+  {
+    state->lastDpi = job->dpiValue;
+  }
+
+  state->lastFinished = now;
+
+  pthread_mutex_unlock (&scheduler->lock);
+}
+
+void schedulerSetOffline (Scheduler *scheduler, int device, int offline)
+{
+  pthread_mutex_lock (&scheduler->lock);
+
+  scheduler->devices[device].offline = offline;
+
+  /* Jobs that were waiting for it may go now */
+  if (!offline)
+    dispatch (scheduler);
+
+  pthread_mutex_unlock (&scheduler->lock);
+}
+
+void schedulerPrintStats (Scheduler *scheduler, FILE *out)
+{
+  struct timespec now;
+  double uptime;
+  int i;
+
+  pthread_mutex_lock (&scheduler->lock);
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  uptime = seconds (&scheduler->created, &now);
+
+  fprintf (out, "queue depth=%d\n", scheduler->queueDepth);
+
+  for (i = 0; i < scheduler->deviceCount; i++)
+  {
+    DeviceState *state = &scheduler->devices[i];
+    double jobs = state->jobs ? state->jobs : 1;
+
+    fprintf (out, "device %d jobs=%lu failed=%lu wait_mean_ms=%.1f "
+	     "wait_max_ms=%.1f service_mean_ms=%.1f service_max_ms=%.1f "
+	     "utilization=%.3f %s\n", i, state->jobs, state->failed,
+	     state->waitTotal * 1000 / jobs, state->waitMax * 1000,
+	     state->serviceTotal * 1000 / jobs, state->serviceMax * 1000,
+	     uptime > 0 ? state->serviceTotal / uptime : 0.0,
+	     state->offline ? "offline" : state->idle ? "idle" : "busy");
+  }
+
+  pthread_mutex_unlock (&scheduler->lock);
+}
+
+int schedulerQueueDepth (Scheduler *scheduler)
+{
+  int depth;
+
+  pthread_mutex_lock (&scheduler->lock);
+  depth = scheduler->queueDepth;
+  pthread_mutex_unlock (&scheduler->lock);
+
+  return depth;
+}
+
+
+static Client *findClient (Scheduler *scheduler, const char *name)
+{
+  Client *client;
+
+  for (client = scheduler->clients; client; client = client->next)
+  {
+    if (!strcmp (client->name, name))
+      return client;
+  }
+
+  client = calloc (1, sizeof (Client));
+  strncpy (client->name, name, sizeof (client->name) - 1);
+  client->next = scheduler->clients;
+  scheduler->clients = client;
+
+  return client;
+}
+
+
+static void dispatch (Scheduler *scheduler)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  while (1)
+  {
+    SchedulerJob **link;
+    SchedulerJob **bestLink = NULL;
+    Client *bestClient = NULL;
+    int bestDevice = -1;
+
+    /* The job that should run next on some idle scanner */
+    for (link = &scheduler->queue; *link; link = &(*link)->next)
+    {
+      SchedulerJob *job = *link;
+      Client *client;
+      int device = pickDevice (scheduler, job, &now);
+
+      if (device < 0)
+	continue;
+
+      client = findClient (scheduler, job->client);
+
+      /* Earlier jobs win ties, so only a strictly better job replaces */
+      if (bestLink == NULL || job->priority > (*bestLink)->priority ||
+	  (job->priority == (*bestLink)->priority &&
+	   client->served < bestClient->served))
+      {
+	bestLink = link;
+	bestClient = client;
+	bestDevice = device;
+      }
+    }
+
+    if (bestLink == NULL)
+      return;
+
+    /* Hand it over */
+    SchedulerJob *job = *bestLink;
+    DeviceState *state = &scheduler->devices[bestDevice];
+
+    *bestLink = job->next;
+    job->next = NULL;
+    job->started = now;
+    scheduler->queueDepth--;
+
+    bestClient->served++;
+    bestClient->queued--;
+
+    state->idle = 0;
+    state->assigned = job;
+    pthread_cond_signal (&state->wake);
+  }
+}
+
+
+static int pickDevice (Scheduler *scheduler, SchedulerJob *job,
+		       struct timespec *now)
+{
+  int best = -1;
+  int bestFresh = 0;
+  int i;
+
+  /* Pinned to one scanner */
+  if (job->device >= 0)
+    return (scheduler->devices[job->device].idle &&
+	    !scheduler->devices[job->device].offline) ? job->device : -1;
+
+  for (i = 0; i < scheduler->deviceCount; i++)
+  {
+    DeviceState *state = &scheduler->devices[i];
+    int fresh;
+
+    if (!state->idle || state->offline)
+      continue;
+
+    fresh = (state->lastDpi == job->dpiValue &&
+	     seconds (&state->lastFinished, now) < scheduler->freshSeconds);
+
+    /* Fresh calibration first, then whoever has been idle longest */
+    if (best < 0 || fresh > bestFresh ||
+	(fresh == bestFresh &&
+	 seconds (&state->lastFinished,
+		  &scheduler->devices[best].lastFinished) > 0))
+    {
+      best = i;
+      bestFresh = fresh;
+    }
+  }
+
+  return best;
+}
+
+
+static double seconds (struct timespec *from, struct timespec *to)
+{
+  return (to->tv_sec - from->tv_sec) +
+    (to->tv_nsec - from->tv_nsec) / 1000000000.0;
+}
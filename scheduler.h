@@ -0,0 +1,98 @@
+/*******************************************************************************
+ *  scheduler.h
+ *
+ *  Purpose: Hands queued scan jobs to idle scanners when primascand has
+ *           several of them.  With a bank of scanners the thing that
+ *           matters is keeping all of them busy, so the scheduler decides
+ *           both which job runs next and which scanner runs it.
+ *
+ *           Which job -     The highest priority first.  Among jobs of the
+ *                           same priority, clients take turns (the client
+ *                           that has been served least goes next), and each
+ *                           client's own jobs run in the order they came in.
+ *
+ *           Which scanner - A job may ask for a particular scanner.
+ *                           Otherwise it prefers an idle scanner that just
+ *                           finished a scan in the same mode, while its
+ *                           lamp and calibration are still fresh.  After
+ *                           that, the scanner that has been idle longest.
+ *
+ *           Queue wait and service time are kept for every scanner.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+
+
+
+/*******************************************************************************
+ *  SchedulerJob - Put one at the start of your own job structure.
+ *                 priority -  Larger runs first (default 0)
+ *                 client -    Who submitted it, for fair queuing
+ *                 dpiValue -  The scan mode, for calibration affinity
+ *                 device -    The scanner it must run on, or -1 for any.
+ *                             It must be one of the scanners there are.
+ *
+ *  The rest is filled in by the scheduler.
+ ******************************************************************************/
+typedef struct SchedulerJob
+{
+  int priority;
+  char client[32];
+  int dpiValue;
+  int device;
+
+  unsigned long sequence;
+  struct timespec queued;
+  struct timespec started;
+  struct SchedulerJob *next;
+} SchedulerJob;
+
+typedef struct Scheduler Scheduler;
+
+
+
+
+/*******************************************************************************
+ *  schedulerCreate() - A scheduler for deviceCount scanners.  A scanner
+ *                     whose last scan in a mode finished less than
+ *                     freshSeconds ago is preferred for that mode.
+ *
+ *  schedulerSubmit() - Queues a job.
+ *
+ *  schedulerNext() -  Called by a scanner's thread when it is idle.  Waits
+ *                     until the scheduler gives it a job.
+ *
+ *  schedulerDone() -  Called by the scanner's thread when the job it was
+ *                     given is finished.  failed is non-zero if the scan
+ *                     did not complete.
+ *
+ *  schedulerSetOffline() - Takes a scanner that has gone away out of
+ *                     rotation (offline non-zero) or puts it back.  An
+ *                     offline scanner is given no jobs; jobs pinned to it
+ *                     wait until it is back.
+ *
+ *  schedulerPrintStats() - Writes per-scanner queue wait, service time
+ *                     and utilization.
+ *
+ *  schedulerQueueDepth() - How many jobs are waiting for a scanner.
+ ******************************************************************************/
+Scheduler *schedulerCreate (int deviceCount, int freshSeconds);
+void schedulerSubmit (Scheduler *scheduler, SchedulerJob *job);
+SchedulerJob *schedulerNext (Scheduler *scheduler, int device);
+void schedulerDone (Scheduler *scheduler, int device, SchedulerJob *job,
+		    int failed);
+void schedulerSetOffline (Scheduler *scheduler, int device, int offline);
+void schedulerPrintStats (Scheduler *scheduler, FILE *out);
+int schedulerQueueDepth (Scheduler *scheduler);
+
+#endif
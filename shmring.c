@@ -0,0 +1,249 @@
+/*******************************************************************************
+ *  shmring.c
+ *
+ *  Purpose: The shared memory row ring.  See shmring.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "shmring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+
+
+struct ShmRing
+{
+  ShmRingHeader *header;
+  char *rows;
+  long size;
+};
+
+
+
+
+/*******************************************************************************
+ *  publish() -        Moves writeCursor on and wakes everyone waiting.
+ ******************************************************************************/
+static void publish (ShmRing *ring, unsigned int cursor);
+
+
+
+
+ShmRing *shmRingCreate (const char *name, ScanParameters *params,
+			int ringRows)
+{
+  ShmRing *ring;
+  ShmRingHeader *header;
+  long size;
+  int fd;
+
+  /* Rows start on a cache line of their own */
+  size = 64 + (long) ringRows * params->bytesPerLine;
+
+  shm_unlink (name);
+  fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+  if (fd < 0)
+    return NULL;
+
+  if (ftruncate (fd, size) < 0)
+  {
+    close (fd);
+    shm_unlink (name);
+    return NULL;
+  }
+
+  header = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (header == MAP_FAILED)
+  {
+    shm_unlink (name);
+    return NULL;
+  }
+
+  header->format = params->format;
+  header->width = params->pixelsPerLine;
+  header->height = params->lines;
+  header->depth = params->depth;
+  header->rowStride = params->bytesPerLine;
+  header->ringRows = ringRows;
+  header->reserveRows = ringRows / 8 > 0 ? ringRows / 8 : 1;
+  header->dataOffset = 64;
+  header->writeCursor = 0;
+  header->state = SHMRING_SCANNING;
+
+  /* Readers check the magic number last, so it goes in last */
+  __atomic_store_n (&header->magic, SHMRING_MAGIC, __ATOMIC_RELEASE);
+
+  ring = calloc (1, sizeof (ShmRing));
+  ring->header = header;
+  ring->rows = (char *) header + header->dataOffset;
+  ring->size = size;
+
+  return ring;
+}
+
+char *shmRingSpace (ShmRing *ring, int *rows)
+{
+  ShmRingHeader *header = ring->header;
+  int slot = header->writeCursor % header->ringRows;
+
+  *rows = header->ringRows - slot;
+
+  /* Readers stay clear of the reserve, so never write past it */
+  if (*rows > header->reserveRows)
+    *rows = header->reserveRows;
+
+  return ring->rows + (long) slot * header->rowStride;
+}
+
+void shmRingCommit (ShmRing *ring, int rows)
+{
+  publish (ring, ring->header->writeCursor + rows);
+}
+
+void shmRingPublish (ShmRing *ring, const char *data, int rows)
+{
+  ShmRingHeader *header = ring->header;
+
+  while (rows > 0)
+  {
+    int space;
+    char *to = shmRingSpace (ring, &space);
+
+    if (space > rows)
+      space = rows;
+
+    memcpy (to, data, (long) space * header->rowStride);
+    shmRingCommit (ring, space);
+
+    data += (long) space * header->rowStride;
+    rows -= space;
+  }
+}
+
+void shmRingFinish (ShmRing *ring, int failed)
+{
+  ShmRingHeader *header = ring->header;
+
+  __atomic_store_n (&header->state, failed ? SHMRING_FAILED : SHMRING_DONE,
+		    __ATOMIC_RELEASE);
+
+  /* Wake anyone waiting for rows that will never come */
+  publish (ring, header->writeCursor);
+}
+
+ShmRing *shmRingAttach (const char *name)
+{
+  ShmRing *ring;
+  ShmRingHeader *header;
+  struct stat info;
+  int fd;
+
+  fd = shm_open (name, O_RDONLY, 0);
+
+  if (fd < 0)
+    return NULL;
+
+  if (fstat (fd, &info) < 0 || info.st_size < (long) sizeof (ShmRingHeader))
+  {
+    close (fd);
+    return NULL;
+  }
+
+  header = mmap (NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+
+  if (header == MAP_FAILED)
+    return NULL;
+
+  if (__atomic_load_n (&header->magic, __ATOMIC_ACQUIRE) != SHMRING_MAGIC)
+  {
+    munmap (header, info.st_size);
+    return NULL;
+  }
+
+  ring = calloc (1, sizeof (ShmRing));
+  ring->header = header;
+  ring->rows = (char *) header + header->dataOffset;
+  ring->size = info.st_size;
+
+  return ring;
+}
+
+const ShmRingHeader *shmRingGetHeader (ShmRing *ring)
+{
+  return ring->header;
+}
+
+unsigned int shmRingWait (ShmRing *ring, unsigned int seen, int timeoutMs)
+{
+  ShmRingHeader *header = ring->header;
+  struct timespec timeout;
+  unsigned int cursor;
+
+  timeout.tv_sec = timeoutMs / 1000;
+  timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+  while ((cursor = __atomic_load_n (&header->writeCursor, __ATOMIC_ACQUIRE))
+	 == seen &&
+	 __atomic_load_n (&header->state, __ATOMIC_ACQUIRE) ==
+	 SHMRING_SCANNING)
+  {
+    /* Sleeps only if the cursor still hasn't moved */
+    if (syscall (SYS_futex, &header->writeCursor, FUTEX_WAIT, seen,
+		 timeoutMs < 0 ? NULL : &timeout, NULL, 0) < 0 &&
+	timeoutMs >= 0)
+      break;
+  }
+
+  return __atomic_load_n (&header->writeCursor, __ATOMIC_ACQUIRE);
+}
+
+const char *shmRingRow (ShmRing *ring, unsigned int row)
+{
+  ShmRingHeader *header = ring->header;
+
+  return ring->rows + (long) (row % header->ringRows) * header->rowStride;
+}
+
+int shmRingIntact (ShmRing *ring, unsigned int row)
+{
+  ShmRingHeader *header = ring->header;
+  unsigned int cursor;
+
+  /* Whatever was copied before this is done before the cursor is read */
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  cursor = __atomic_load_n (&header->writeCursor, __ATOMIC_ACQUIRE);
+
+  return cursor - row <= (unsigned int) (header->ringRows -
+					  header->reserveRows);
+}
+
+void shmRingClose (ShmRing *ring)
+{
+  munmap (ring->header, ring->size);
+  free (ring);
+}
+
+
+static void publish (ShmRing *ring, unsigned int cursor)
+{
+  ShmRingHeader *header = ring->header;
+
+  __atomic_store_n (&header->writeCursor, cursor, __ATOMIC_RELEASE);
+  syscall (SYS_futex, &header->writeCursor, FUTEX_WAKE, 0x7fffffff, NULL,
+	   NULL, 0);
+}
@@ -0,0 +1,134 @@
+/*******************************************************************************
+ *  shmring.h
+ *
+ *  Purpose: Publishes scan rows into a POSIX shared memory ring so that a
+ *           preview or OCR process on the same machine can read them as
+ *           they arrive, straight out of memory, without a socket or pipe
+ *           in between.
+ *
+ *           The shared memory starts with a ShmRingHeader, followed by
+ *           ringRows rows of rowStride bytes.  Row n of the scan is stored
+ *           in slot n % ringRows.  writeCursor is the number of rows that
+ *           have been published; readers sleep on it with a futex and are
+ *           woken every time it moves.
+ *
+ *           The writer never waits for readers.  It reads the scanner
+ *           straight into the reserveRows slots after writeCursor, so
+ *           only the last ringRows - reserveRows rows published can be
+ *           read; anything older may be overwritten at any time, even
+ *           while a reader is copying it.  A reader copies rows out and
+ *           then checks with shmRingIntact() that they were not
+ *           overwritten meanwhile.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include "scanner.h"
+
+#define SHMRING_MAGIC 0x52535250	/* "PRSR" */
+
+#define SHMRING_SCANNING 0
+#define SHMRING_DONE     1
+#define SHMRING_FAILED   2
+
+
+
+
+/*******************************************************************************
+ *  ShmRingHeader - The start of the shared memory.  A reader can map it
+ *                  with nothing more than this structure.
+ *
+ *  format, width, height, depth, rowStride - Same as ScanParameters
+ *                  (format, pixelsPerLine, lines, depth, bytesPerLine)
+ *  ringRows -      How many rows the ring holds
+ *  reserveRows -   How many of them, just after writeCursor, the writer
+ *                  may be filling
+ *  dataOffset -    Where the first row starts, from the start of the header
+ *  writeCursor -   Rows published so far (the futex word)
+ *  state -         SHMRING_SCANNING, SHMRING_DONE or SHMRING_FAILED
+ ******************************************************************************/
+typedef struct ShmRingHeader
+{
+  unsigned int magic;
+  int format;
+  int width;
+  int height;
+  int depth;
+  int rowStride;
+  int ringRows;
+  int reserveRows;
+  int dataOffset;
+  volatile unsigned int writeCursor;
+  volatile unsigned int state;
+} ShmRingHeader;
+
+typedef struct ShmRing ShmRing;
+
+
+
+
+/*******************************************************************************
+ *  Writer
+ *  ------
+ *
+ *  shmRingCreate() -  Creates (or replaces) the shared memory called name,
+ *                     e.g. "/primascan", for an image described by params.
+ *                     Returns NULL on failure.
+ *
+ *  shmRingSpace() -   Where the next rows should be written, so they can be
+ *                     read from the scanner straight into the ring.  At
+ *                     most *rows rows fit there, no more than reserveRows.
+ *
+ *  shmRingCommit() -  Publishes rows written at shmRingSpace().
+ *
+ *  shmRingPublish() - Copies rows into the ring and publishes them.
+ *
+ *  shmRingFinish() -  Marks the scan done (or failed) and wakes readers.
+ *
+ *  Reader
+ *  ------
+ *
+ *  shmRingAttach() -  Maps an existing ring.  Returns NULL on failure.
+ *
+ *  shmRingGetHeader() - The header, to read the image description.
+ *
+ *  shmRingWait() -    Waits until more than seen rows are published or the
+ *                     scan is finished, and returns writeCursor.  Gives up
+ *                     after timeoutMs (-1 waits forever).
+ *
+ *  shmRingRow() -     Row number row of the scan.
+ *
+ *  shmRingIntact() -  Whether row, and the rows after it, can still be
+ *                     read.  Check it before copying rows out of the
+ *                     ring, and again afterwards: if it has gone false the
+ *                     copy may be torn and the rows are lost.
+ *
+ *  Both
+ *  ----
+ *
+ *  shmRingClose() -   Unmaps the ring.  The name is left in place, so a
+ *                     reader that starts late can still read the end of
+ *                     the scan.  The next shmRingCreate() with the same
+ *                     name replaces it.
+ ******************************************************************************/
+ShmRing *shmRingCreate (const char *name, ScanParameters *params,
+			int ringRows);
+char *shmRingSpace (ShmRing *ring, int *rows);
+void shmRingCommit (ShmRing *ring, int rows);
+void shmRingPublish (ShmRing *ring, const char *data, int rows);
+void shmRingFinish (ShmRing *ring, int failed);
+
+ShmRing *shmRingAttach (const char *name);
+const ShmRingHeader *shmRingGetHeader (ShmRing *ring);
+unsigned int shmRingWait (ShmRing *ring, unsigned int seen, int timeoutMs);
+const char *shmRingRow (ShmRing *ring, unsigned int row);
+int shmRingIntact (ShmRing *ring, unsigned int row);
+
+void shmRingClose (ShmRing *ring);
+
+#endif
@@ -0,0 +1,462 @@
+/*******************************************************************************
+ *  simtransport.c
+ *
+ *  Purpose: A simulated Colorado 2400u.  It lets the driver, the daemon and
+ *           the tools be run without a scanner attached.
+ *
+ *           The simulation is deliberately simple.  The engine fills the
+ *           buffer of every IN control transfer with the response that was
+ *           recorded by sniffusb before it asks the device, so the
+ *           simulated device just leaves the buffer alone.  Bulk writes are
+ *           accepted and thrown away.  Bulk reads return a test pattern so
+ *           the output can be checked by eye.
+ *
+ *           PRIMASCAN_SIM_DEVICES - How many simulated scanners are
+ *                                   attached (default 1).
+ *
+ *           PRIMASCAN_SIM_FAULT -   kind:n makes something go wrong at the
+ *                                   n'th transfer, to try out recovery:
+ *             stall:n -   the bulk IN endpoint stalls until its halt is
+ *                         cleared
+ *             timeout:n - that one transfer times out
+ *             poll:n -    the scanner never reports ready again until it
+ *                         is reset
+ *             hang:n -    every transfer times out until it is reset
+ *             short:n -   from then on, bulk reads only return part of
+ *                         what was asked for
+ *             unplug:n -  the scanner drops off the bus for
+ *                         SIM_UNPLUG_SECONDS: transfers fail at once and
+ *                         it can be neither reset nor opened again.  Only
+ *                         once per scanner, however often it is opened.
+ *
+ *           PRIMASCAN_SIM_TIMING -  Makes transfers take as long as they
+ *                                   would on a real scanner, for
+ *                                   benchmarks.  Without it they take no
+ *                                   time at all.
+ *             usb -       Rough figures for a full speed (USB 1.1) device:
+ *                         1 ms for a control transfer, 1 ms plus the data
+ *                         at 1 MB/s for a bulk transfer
+ *             c:b -       c microseconds per transfer, plus the data at b
+ *                         bytes per second for bulk transfers
+ *             <file> -    The output of spike4.pl for a sniffusb log.
+ *                         Transfer n takes the pause before URB n plus the
+ *                         time URB n took.  Transfers after the end of the
+ *                         log take the usb figures.
+ *
+ *           Queued control transfers (submitControl()) share one
+ *           turnaround: flush() takes as long as one control transfer,
+ *           plus SIM_QUEUED_US for every other transfer in the queue.  A
+ *           log is no help there, the sniffed driver never queued.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "transport.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+
+/*******************************************************************************
+ *  SimTiming -    How long transfers take (PRIMASCAN_SIM_TIMING), the same
+ *                 for every simulated scanner.
+ *                 enabled -   Zero if transfers take no time
+ *                 transferUs, bytesPerSecond - The model for a transfer
+ *                 replay -    Microseconds for each transfer in turn, from
+ *                             a spike4.pl log, replayCount of them
+ ******************************************************************************/
+typedef struct SimTiming
+{
+  int enabled;
+  long transferUs;
+  long bytesPerSecond;
+  long *replay;
+  unsigned long replayCount;
+} SimTiming;
+
+static SimTiming timing;
+
+
+
+
+/*******************************************************************************
+ *  A simulated device only needs to remember which one it is and where in
+ *  the test pattern its next bulk read starts, plus the fault it was told
+ *  to have (PRIMASCAN_SIM_FAULT) and what state that left it in.
+ ******************************************************************************/
+#define FAULT_NONE    0
+#define FAULT_STALL   1
+#define FAULT_TIMEOUT 2
+#define FAULT_POLL    3
+#define FAULT_HANG    4
+#define FAULT_SHORT   5
+#define FAULT_UNPLUG  6
+
+/* About what a short control transfer takes on a full speed bus */
+#define SIM_QUEUED_US 50
+
+/* How long an unplugged scanner stays away, for so many scanners */
+#define SIM_UNPLUG_SECONDS 5
+#define SIM_MAX_DEVICES    16
+
+/* When each unplugged scanner comes back, 0 if it never went */
+static time_t pluggedInAt[SIM_MAX_DEVICES];
+
+typedef struct SimDevice
+{
+  int index;
+  unsigned long bytesRead;
+
+  int fault;
+  unsigned long faultAt;
+  unsigned long transfers;
+  int halted;
+  int notReady;
+  int hung;
+  int shortReads;
+
+  int queued;
+  int queueFailed;
+} SimDevice;
+
+
+
+
+/*******************************************************************************
+ *  simFault() -       Counts a transfer and sets off the fault when its
+ *                     turn comes.  Returns 1 if this transfer should time
+ *                     out, after waiting as long as a real one would.
+ *
+ *  simDelay() -       Takes as long as the transfer just counted would on
+ *                     a real scanner.  bulk is non-zero for a bulk
+ *                     transfer of size bytes.
+ *
+ *  loadReplay() -     Reads the transfer times from a spike4.pl log into
+ *                     timing.  Returns 0 if the file can't be read.
+ *
+ *  isUnplugged() -    Whether the scanner with this index is off the bus.
+ ******************************************************************************/
+static int simFault (SimDevice *sim, int timeout);
+static void simDelay (SimDevice *sim, int bulk, int size);
+static int loadReplay (const char *path);
+static int isUnplugged (int index);
+
+
+
+
+static void simInit ()
+{
+  char *model = getenv ("PRIMASCAN_SIM_TIMING");
+
+  if (model == NULL || model[0] == '\0')
+    return;
+
+  /* The usb figures, also for what a replay does not cover */
+  timing.enabled = 1;
+  timing.transferUs = 1000;
+  timing.bytesPerSecond = 1000000;
+
+  if (!strcmp (model, "usb"))
+    return;
+
+  if (model[0] >= '0' && model[0] <= '9' && strchr (model, ':') != NULL)
+  {
+    timing.transferUs = atol (model);
+    timing.bytesPerSecond = atol (strchr (model, ':') + 1);
+
+    if (timing.bytesPerSecond <= 0)
+      timing.bytesPerSecond = 1000000;
+
+    return;
+  }
+
+  if (!loadReplay (model))
+    fprintf (stderr, "Could not read transfer times from %s, using usb\n",
+	     model);
+}
+
+static int simCount ()
+{
+  char *devices = getenv ("PRIMASCAN_SIM_DEVICES");
+
+  if (devices == NULL)
+    return 1;
+
+  return atoi (devices);
+}
+
+static void *simOpen (int index)
+{
+  SimDevice *device;
+
+  if (index < 0 || index >= simCount () || isUnplugged (index))
+    return NULL;
+
+  device = calloc (1, sizeof (SimDevice));
+
+  if (device == NULL)
+    return NULL;
+
+  device->index = index;
+
+  /* kind:n */
+  char *fault = getenv ("PRIMASCAN_SIM_FAULT");
+  char *colon = fault ? strchr (fault, ':') : NULL;
+
+  if (colon != NULL)
+  {
+    if (!strncmp (fault, "stall:", 6))
+      device->fault = FAULT_STALL;
+    else if (!strncmp (fault, "timeout:", 8))
+      device->fault = FAULT_TIMEOUT;
+    else if (!strncmp (fault, "poll:", 5))
+      device->fault = FAULT_POLL;
+    else if (!strncmp (fault, "hang:", 5))
+      device->fault = FAULT_HANG;
+    else if (!strncmp (fault, "short:", 6))
+      device->fault = FAULT_SHORT;
+    else if (!strncmp (fault, "unplug:", 7))
+      device->fault = FAULT_UNPLUG;
+
+    device->faultAt = strtoul (colon + 1, NULL, 0);
+  }
+
+  return device;
+}
+
+static void simClose (void *device)
+{
+  free (device);
+}
+
+static int simReset (void *device)
+{
+  SimDevice *sim = device;
+
+  if (isUnplugged (sim->index))
+    return -1;
+
+  sim->bytesRead = 0;
+  sim->halted = 0;
+  sim->notReady = 0;
+  sim->hung = 0;
+  return 0;
+}
+
+static int simClearHalt (void *device, int ep)
+{
+  ((SimDevice *) device)->halted = 0;
+  return 0;
+}
+
+static int simControlMsg (void *device, int requestType, int request,
+			  int value, int index, char *buffer, int size,
+			  int timeout)
+{
+  SimDevice *sim = device;
+
+  if (simFault (sim, timeout))
+    return -1;
+
+  simDelay (sim, 0, size);
+
+  /* A scanner that is not ready answers every IN request with "busy" */
+  if (sim->notReady && (requestType & 0x80) && size > 0)
+    buffer[0] = ~buffer[0];
+
+  /* IN requests answer with whatever the engine expects to see */
+  return size;
+}
+
+static int simSubmitControl (void *device, int requestType, int request,
+			     int value, int index, char *buffer, int size,
+			     int timeout)
+{
+  SimDevice *sim = device;
+
+  /* Whatever goes wrong only shows when the queue is flushed */
+  if (simFault (sim, timeout))
+    sim->queueFailed = 1;
+
+  sim->queued++;
+  return 0;
+}
+
+static int simFlush (void *device)
+{
+  SimDevice *sim = device;
+  int failed = sim->queueFailed;
+
+  if (timing.enabled && sim->queued > 0)
+    usleep (timing.transferUs + (sim->queued - 1) * SIM_QUEUED_US);
+
+  sim->queued = 0;
+  sim->queueFailed = 0;
+
+  return failed ? -1 : 0;
+}
+
+static int simBulkRead (void *device, int ep, char *buffer, int size,
+			int timeout)
+{
+  SimDevice *sim = device;
+  int i;
+
+  if (simFault (sim, timeout))
+    return -1;
+
+  /* A stalled endpoint fails straight away */
+  if (sim->halted)
+    return -1;
+
+  /* A third at a time, in whole 64 byte packets */
+  if (sim->shortReads && size > 64)
+    size = (size / 3 + 63) & ~63;
+
+  simDelay (sim, 1, size);
+
+  /* Diagonal stripes, offset a little for each scanner */
+  for (i = 0; i < size; ++i)
+    buffer[i] = (char) ((sim->bytesRead + i) / 7 + sim->index * 64);
+
+  sim->bytesRead += size;
+  return size;
+}
+
+static int simBulkWrite (void *device, int ep, char *buffer, int size,
+			 int timeout)
+{
+  if (simFault (device, timeout))
+    return -1;
+
+  simDelay (device, 1, size);
+  return size;
+}
+
+const Transport simTransport = {
+  "sim",
+  simInit,
+  simCount,
+  simOpen,
+  simClose,
+  simReset,
+  simClearHalt,
+  simControlMsg,
+  simBulkRead,
+  simBulkWrite,
+  simSubmitControl,
+  simFlush,
+  NULL,
+  NULL
+};
+
+
+static int simFault (SimDevice *sim, int timeout)
+{
+  if (++sim->transfers == sim->faultAt)
+  {
+    if (sim->fault == FAULT_STALL)
+      sim->halted = 1;
+    else if (sim->fault == FAULT_POLL)
+      sim->notReady = 1;
+    else if (sim->fault == FAULT_HANG)
+      sim->hung = 1;
+    else if (sim->fault == FAULT_SHORT)
+      sim->shortReads = 1;
+    else if (sim->fault == FAULT_UNPLUG && sim->index < SIM_MAX_DEVICES &&
+	     pluggedInAt[sim->index] == 0)
+      pluggedInAt[sim->index] = time (NULL) + SIM_UNPLUG_SECONDS;
+  }
+
+  /* Nothing there to wait for */
+  if (isUnplugged (sim->index))
+    return 1;
+
+  if (sim->hung ||
+      (sim->fault == FAULT_TIMEOUT && sim->transfers == sim->faultAt))
+  {
+    usleep (timeout * 1000);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+static void simDelay (SimDevice *sim, int bulk, int size)
+{
+  long us;
+
+  if (!timing.enabled)
+    return;
+
+  /* simFault() has already counted this transfer */
+  if (sim->transfers <= timing.replayCount)
+    us = timing.replay[sim->transfers - 1];
+  else
+    us = timing.transferUs +
+      (bulk ? size * 1000000LL / timing.bytesPerSecond : 0);
+
+  if (us > 0)
+    usleep (us);
+}
+
+
+static int loadReplay (const char *path)
+{
+  FILE *log = fopen (path, "r");
+  unsigned long allocated = 0;
+  char line[256];
+  long pause = 0;
+  long ms;
+
+  if (log == NULL)
+    return 0;
+
+  /*
+   * spike4.pl prints "pause N ms" before each URB, then
+   * "Urb N (C) ep=E (read) N ms" with how long the URB itself took.
+   */
+  while (fgets (line, sizeof (line), log) != NULL)
+  {
+    if (sscanf (line, "pause %ld ms", &ms) == 1)
+    {
+      pause = ms;
+    }
+    else if (!strncmp (line, "Urb ", 4) && strstr (line, " ms") != NULL)
+    {
+      char *time = strstr (line, ") ");
+
+      /* The time is after the direction, the second ")" */
+      if (time != NULL)
+	time = strstr (time + 2, ") ");
+
+      if (time == NULL || sscanf (time + 2, "%ld", &ms) != 1)
+	continue;
+
+      if (timing.replayCount == allocated)
+      {
+	allocated = allocated ? allocated * 2 : 1024;
+	timing.replay = realloc (timing.replay, allocated * sizeof (long));
+      }
+
+      timing.replay[timing.replayCount++] = (pause + ms) * 1000;
+      pause = 0;
+    }
+  }
+
+  fclose (log);
+  return 1;
+}
+
+
+static int isUnplugged (int index)
+{
+  return index < SIM_MAX_DEVICES && time (NULL) < pluggedInAt[index];
+}
@@ -0,0 +1,357 @@
+/*******************************************************************************
+ *  spool.c
+ *
+ *  Purpose: A memory buffer that spills to a temporary file.  See spool.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "spool.h"
+#include "arena.h"
+#include "trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHUNK_SIZE 0x10000
+
+
+
+
+/*******************************************************************************
+ *  Chunk -        A piece of the memory buffer.  The writer appends at end,
+ *                 the reader takes from start.  A chunk is only given back
+ *                 once it is full and all of it has been read, so the
+ *                 writer never has a chunk taken away under it.
+ *
+ *  Spool -        Data in memory always comes before data in the file.
+ *                 While the file holds anything, new data goes to the file
+ *                 too, so the order is kept.
+ *                 writeChunk - The chunk spoolSpace() handed out, or NULL
+ *                              if it handed out staging (for the file)
+ *                 fileRead, fileWrite - The part of the file not read yet
+ *                 arena -      Where the chunks and staging come from
+ ******************************************************************************/
+typedef struct Chunk
+{
+  int start;
+  int end;
+  struct Chunk *next;
+  char data[CHUNK_SIZE];
+} Chunk;
+
+struct Spool
+{
+  Chunk *head;
+  Chunk *tail;
+  Chunk *freeChunks;
+  long memoryUsed;
+  long memoryLimit;
+  Chunk *writeChunk;
+
+  int fd;
+  char *staging;
+  long fileRead;
+  long fileWrite;
+  long spilled;
+
+  int finished;
+  int failed;
+
+  Arena *arena;
+
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+
+
+
+/*******************************************************************************
+ *  openFile() -       Creates the spill file and deletes its name, so it
+ *                     goes away with the process.  Returns 0 on failure.
+ ******************************************************************************/
+static int openFile (Spool *spool);
+
+
+
+
+Spool *spoolCreate (long memoryLimit, long expected)
+{
+  Spool *spool = calloc (1, sizeof (Spool));
+  long chunks;
+  long i;
+
+  spool->memoryLimit = memoryLimit;
+  spool->fd = -1;
+
+  /* As many chunks as the image can use, so spoolSpace() never allocates */
+  if (expected > memoryLimit)
+    expected = memoryLimit;
+
+  chunks = (expected + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  spool->arena = arenaCreate (chunks * sizeof (Chunk) + CHUNK_SIZE);
+
+  if (spool->arena == NULL)
+  {
+    free (spool);
+    return NULL;
+  }
+
+  for (i = 0; i < chunks; i++)
+  {
+    Chunk *chunk = arenaAlloc (spool->arena, sizeof (Chunk));
+
+    chunk->next = spool->freeChunks;
+    spool->freeChunks = chunk;
+  }
+
+  spool->staging = arenaAlloc (spool->arena, CHUNK_SIZE);
+
+  pthread_mutex_init (&spool->lock, NULL);
+  pthread_cond_init (&spool->changed, NULL);
+
+  return spool;
+}
+
+char *spoolSpace (Spool *spool, int *size)
+{
+  Chunk *chunk = NULL;
+
+  pthread_mutex_lock (&spool->lock);
+
+  /* The file has been drained, start it over from the beginning */
+  if (spool->fileWrite > 0 && spool->fileRead == spool->fileWrite)
+    spool->fileRead = spool->fileWrite = 0;
+
+  if (spool->fileWrite == 0)
+  {
+    if (spool->tail != NULL && spool->tail->end < CHUNK_SIZE)
+    {
+      chunk = spool->tail;
+    }
+    else if (spool->memoryUsed + CHUNK_SIZE <= spool->memoryLimit)
+    {
+      chunk = spool->freeChunks;
+
+      if (chunk != NULL)
+	spool->freeChunks = chunk->next;
+      else
+	chunk = arenaAlloc (spool->arena, sizeof (Chunk));
+
+      chunk->start = chunk->end = 0;
+      chunk->next = NULL;
+
+      if (spool->tail != NULL)
+	spool->tail->next = chunk;
+      else
+	spool->head = chunk;
+
+      spool->tail = chunk;
+      spool->memoryUsed += CHUNK_SIZE;
+    }
+  }
+
+  pthread_mutex_unlock (&spool->lock);
+
+  spool->writeChunk = chunk;
+
+  if (chunk != NULL)
+  {
+    *size = CHUNK_SIZE - chunk->end;
+    return chunk->data + chunk->end;
+  }
+
+  /* Memory is full (or already spilled), this goes to the file */
+  *size = CHUNK_SIZE;
+  return spool->staging;
+}
+
+int spoolCommit (Spool *spool, int length)
+{
+  if (spool->writeChunk == NULL && length > 0)
+  {
+    long offset = spool->fileWrite;
+    int written = 0;
+    int result;
+
+    if (spool->fd < 0 && !openFile (spool))
+      return 0;
+
+    /* Only the writer moves fileWrite, so this needs no lock */
+    while (written < length)
+    {
+      result = pwrite (spool->fd, spool->staging + written,
+		       length - written, offset + written);
+
+      if (result <= 0)
+	return 0;
+
+      written += result;
+    }
+  }
+
+  pthread_mutex_lock (&spool->lock);
+
+  if (spool->writeChunk != NULL)
+  {
+    spool->writeChunk->end += length;
+  }
+  else
+  {
+    spool->fileWrite += length;
+    spool->spilled += length;
+  }
+
+  pthread_cond_broadcast (&spool->changed);
+  pthread_mutex_unlock (&spool->lock);
+
+  return 1;
+}
+
+void spoolFinish (Spool *spool, int failed)
+{
+  pthread_mutex_lock (&spool->lock);
+  spool->finished = 1;
+  spool->failed = failed;
+  pthread_cond_broadcast (&spool->changed);
+  pthread_mutex_unlock (&spool->lock);
+}
+
+int spoolRead (Spool *spool, char *buffer, int maxLength, int *length)
+{
+  Chunk *chunk;
+  long offset;
+  int count;
+
+  *length = 0;
+
+  pthread_mutex_lock (&spool->lock);
+
+  while (1)
+  {
+    chunk = spool->head;
+
+    /* Memory first */
+    if (chunk != NULL && chunk->start < chunk->end)
+    {
+      count = chunk->end - chunk->start;
+
+      if (count > maxLength)
+	count = maxLength;
+
+      /* The writer only ever adds after end */
+      pthread_mutex_unlock (&spool->lock);
+      memcpy (buffer, chunk->data + chunk->start, count);
+      pthread_mutex_lock (&spool->lock);
+
+      chunk->start += count;
+
+      if (chunk->start == CHUNK_SIZE)
+      {
+	spool->head = chunk->next;
+
+	if (spool->head == NULL)
+	  spool->tail = NULL;
+
+	chunk->next = spool->freeChunks;
+	spool->freeChunks = chunk;
+	spool->memoryUsed -= CHUNK_SIZE;
+      }
+
+      break;
+    }
+
+    /* Then the file */
+    if (spool->fileRead < spool->fileWrite)
+    {
+      offset = spool->fileRead;
+      count = spool->fileWrite - spool->fileRead < maxLength ?
+	spool->fileWrite - spool->fileRead : maxLength;
+
+      pthread_mutex_unlock (&spool->lock);
+      count = pread (spool->fd, buffer, count, offset);
+      pthread_mutex_lock (&spool->lock);
+
+      if (count <= 0)
+      {
+	pthread_mutex_unlock (&spool->lock);
+	return SCANNER_ERROR;
+      }
+
+      spool->fileRead += count;
+      break;
+    }
+
+    if (spool->finished)
+    {
+      pthread_mutex_unlock (&spool->lock);
+      return spool->failed ? SCANNER_ERROR : SCANNER_EOF;
+    }
+
+    /* The consumer is ahead of the scanner */
+    if (tracing)
+    {
+      struct timespec start;
+
+      traceNow (&start);
+      pthread_cond_wait (&spool->changed, &spool->lock);
+      traceComplete ("wait", "wait for the scanner", &start, NULL);
+    }
+    else
+    {
+      pthread_cond_wait (&spool->changed, &spool->lock);
+    }
+  }
+
+  pthread_mutex_unlock (&spool->lock);
+
+  *length = count;
+  return SCANNER_GOOD;
+}
+
+long spoolSpilled (Spool *spool)
+{
+  return spool->spilled;
+}
+
+long spoolAllocations (Spool *spool)
+{
+  return arenaOverflows (spool->arena);
+}
+
+void spoolDestroy (Spool *spool)
+{
+  if (spool->fd >= 0)
+    close (spool->fd);
+
+  pthread_mutex_destroy (&spool->lock);
+  pthread_cond_destroy (&spool->changed);
+
+  /* Every chunk, whether queued or free, goes with the arena */
+  arenaDestroy (spool->arena);
+  free (spool);
+}
+
+
+static int openFile (Spool *spool)
+{
+  const char *directory = getenv ("TMPDIR");
+  char path[256];
+
+  if (directory == NULL || directory[0] == '\0')
+    directory = "/tmp";
+
+  snprintf (path, sizeof (path), "%s/primascan-spool-XXXXXX", directory);
+  spool->fd = mkstemp (path);
+
+  if (spool->fd < 0)
+    return 0;
+
+  unlink (path);
+  return 1;
+}
@@ -0,0 +1,80 @@
+/*******************************************************************************
+ *  spool.h
+ *
+ *  Purpose: Keeps the scanner reading at full speed when whatever consumes
+ *           the image falls behind (a slow disk, a pipe nobody is reading).
+ *           If reading stalls, the bulk read timeout can fire in the middle
+ *           of the page and the scan is lost.
+ *
+ *           One thread reads from the scanner into the spool and never
+ *           waits for the consumer.  Data is kept in memory up to a limit;
+ *           past that it is appended to a temporary file.  The consumer
+ *           reads it back in order, memory first, then the file.  Once the
+ *           file has been drained the spool goes back to memory.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include "scanner.h"
+
+#define SPOOL_MEMORY_LIMIT 0x400000	/* 4 MB, more than a color page */
+
+typedef struct Spool Spool;
+
+
+
+
+/*******************************************************************************
+ *  spoolCreate() -    A spool that keeps up to memoryLimit bytes in memory
+ *                     before spilling to a file in $TMPDIR (or /tmp).  The
+ *                     file is deleted as soon as it is created.  Memory for
+ *                     expected bytes (the size of the image), up to the
+ *                     limit, is allocated now.  Returns NULL if it can't be.
+ *
+ *  Writer
+ *  ------
+ *
+ *  spoolSpace() -     Where the next data should be written, so it can be
+ *                     read from the scanner straight into the spool.  At
+ *                     most *size bytes fit there.
+ *
+ *  spoolCommit() -    Adds length bytes written at spoolSpace().  Returns 0
+ *                     if they could not be spilled to disk.
+ *
+ *  spoolFinish() -    No more data is coming.  failed is non-zero if the
+ *                     scan did not complete.
+ *
+ *  Reader
+ *  ------
+ *
+ *  spoolRead() -      Copies up to maxLength bytes into buffer, waiting if
+ *                     there are none yet.  Returns SCANNER_GOOD with *length
+ *                     set, or SCANNER_EOF (SCANNER_ERROR if the scan
+ *                     failed) once everything has been read.
+ *
+ *  spoolSpilled() -   How many bytes went through the file, for the logs.
+ *
+ *  spoolAllocations() - How many times the writer had to allocate memory
+ *                     because expected was too small.  0 for a scan that
+ *                     is as large as its parameters say.
+ *
+ *  spoolDestroy() -   Frees the spool and removes its file.
+ ******************************************************************************/
+Spool *spoolCreate (long memoryLimit, long expected);
+
+char *spoolSpace (Spool *spool, int *size);
+int spoolCommit (Spool *spool, int length);
+void spoolFinish (Spool *spool, int failed);
+
+int spoolRead (Spool *spool, char *buffer, int maxLength, int *length);
+long spoolSpilled (Spool *spool);
+long spoolAllocations (Spool *spool);
+
+void spoolDestroy (Spool *spool);
+
+#endif
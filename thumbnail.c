@@ -0,0 +1,651 @@
+/*******************************************************************************
+ *  thumbnail.c
+ *
+ *  Purpose: Box-filtered thumbnails written as PNG.  See thumbnail.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "thumbnail.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* How far back deflate may look, and the longest match it may send */
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_MAX_MATCH 258
+
+/* Entries of the hash of 3 bytes, and how many earlier places with the
+   same hash are tried for a match */
+#define DEFLATE_HASH_BITS 14
+#define DEFLATE_CHAIN 32
+
+
+
+
+/*******************************************************************************
+ *  crcTable -     The CRC-32 table of the PNG specification.
+ *
+ *  crcBuilt -     Builds it just once.
+ ******************************************************************************/
+static unsigned long crcTable[256];
+static pthread_once_t crcBuilt = PTHREAD_ONCE_INIT;
+
+
+
+
+/*******************************************************************************
+ *  lengthBase -    The shortest match each length code stands for, and
+ *  lengthExtra -   the bits sent after it (RFC 1951, 3.2.5).
+ *
+ *  distanceBase -  The same for the distance codes.
+ *  distanceExtra -
+ ******************************************************************************/
+static const unsigned short lengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const unsigned char lengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const unsigned short distanceBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577
+};
+
+static const unsigned char distanceExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+
+
+
+/*******************************************************************************
+ *  Thumbnail -    columnEnd -  The scanned pixel each column of the
+ *                              thumbnail ends before.  It starts where the
+ *                              one before it ended.
+ *                 sums -       The samples of each column added up over
+ *                              the scanned rows of the thumbnail row being
+ *                              made, channels per column
+ *                 scannedRows - Rows of the image added so far
+ *                 rowStart -   The scanned row the thumbnail row being made
+ *                              started at
+ *                 row -        Thumbnail rows finished
+ *                 pixels -     The thumbnail, 8 bits per sample
+ ******************************************************************************/
+struct Thumbnail
+{
+  ScanParameters params;
+  int width;
+  int height;
+  int channels;
+
+  int *columnEnd;
+  unsigned long *sums;
+  int scannedRows;
+  int rowStart;
+  int row;
+
+  unsigned char *pixels;
+};
+
+
+
+
+/*******************************************************************************
+ *  BitWriter -    out -    Where the deflate stream goes
+ *                 used -   Whole bytes written to out
+ *                 bits -   Bits not written yet, the first in the low bit
+ *                 count -  How many of them there are
+ ******************************************************************************/
+typedef struct
+{
+  unsigned char *out;
+  long used;
+  unsigned long bits;
+  int count;
+} BitWriter;
+
+
+
+
+/*******************************************************************************
+ *  countWhite() -     How many of the pixels from first to end (not
+ *                     included) of a row of text are white, 1 bits with
+ *                     the high bit first.
+ *
+ *  addRow() -         Adds one scanned row to sums.
+ *
+ *  finishRow() -      Turns sums into the next row of the thumbnail.
+ *
+ *  filterRow() -      Writes row y of the thumbnail as PNG filters it:
+ *                     the filter type, then the row with no filter, Sub
+ *                     or Up, whichever leaves the smallest differences.
+ *
+ *  deflateFixed() -   Compresses length bytes of in to out as one deflate
+ *                     block with the fixed Huffman codes, and returns how
+ *                     many bytes that took, or -1 if there was no memory.
+ *                     A byte never takes more than 11 bits.
+ *
+ *  putBits() -        Adds count bits of value to the stream, low bit
+ *                     first.
+ *
+ *  putCode() -        Adds a Huffman code, which goes high bit first.
+ *
+ *  putSymbol() -      Adds the fixed code of a literal/length symbol.
+ *
+ *  putMatch() -       Adds a match of length bytes distance back.
+ *
+ *  buildCrcTable() -  Fills in crcTable.
+ *
+ *  writeChunk() -     Writes a PNG chunk with its length and CRC.
+ ******************************************************************************/
+static int countWhite (const unsigned char *row, int first, int end);
+static void addRow (Thumbnail *thumbnail, const unsigned char *data);
+static void finishRow (Thumbnail *thumbnail);
+static void filterRow (Thumbnail *thumbnail, int y, unsigned char *out);
+static long deflateFixed (const unsigned char *in, long length,
+			  unsigned char *out);
+static void putBits (BitWriter *writer, unsigned long value, int count);
+static void putCode (BitWriter *writer, unsigned int code, int length);
+static void putSymbol (BitWriter *writer, int symbol);
+static void putMatch (BitWriter *writer, int length, int distance);
+static void buildCrcTable (void);
+static int writeChunk (FILE *out, const char *type,
+		       const unsigned char *data, long length);
+
+
+
+
+Thumbnail *thumbnailCreate (ScanParameters *params, int width)
+{
+  Thumbnail *thumbnail = calloc (1, sizeof (Thumbnail));
+  int i;
+
+  if (thumbnail == NULL)
+    return NULL;
+
+  /* Never larger than the scan */
+  if (width > params->pixelsPerLine)
+    width = params->pixelsPerLine;
+
+  thumbnail->params = *params;
+  thumbnail->width = width;
+  thumbnail->height = ((long) params->lines * width +
+		       params->pixelsPerLine / 2) / params->pixelsPerLine;
+  thumbnail->channels = (params->format == SCAN_FORMAT_RGB) ? 3 : 1;
+
+  if (thumbnail->height < 1)
+    thumbnail->height = 1;
+
+  thumbnail->columnEnd = malloc (width * sizeof (int));
+  thumbnail->sums = calloc (width * thumbnail->channels,
+			    sizeof (unsigned long));
+  thumbnail->pixels = malloc ((long) thumbnail->height * width *
+			      thumbnail->channels);
+
+  if (thumbnail->columnEnd == NULL || thumbnail->sums == NULL ||
+      thumbnail->pixels == NULL)
+  {
+    thumbnailDestroy (thumbnail);
+    return NULL;
+  }
+
+  for (i = 0; i < width; i++)
+    thumbnail->columnEnd[i] = (long) (i + 1) * params->pixelsPerLine / width;
+
+  /* What has not been scanned yet shows as paper */
+  memset (thumbnail->pixels, 0xff,
+	  (long) thumbnail->height * width * thumbnail->channels);
+
+  return thumbnail;
+}
+
+void thumbnailRows (Thumbnail *thumbnail, const char *data, int rows)
+{
+  int i;
+
+  for (i = 0; i < rows; i++)
+  {
+    /* Anything past the rows the parameters promised is left out */
+    if (thumbnail->row == thumbnail->height)
+      return;
+
+    addRow (thumbnail, (const unsigned char *) data +
+	    (long) i * thumbnail->params.bytesPerLine);
+    thumbnail->scannedRows++;
+
+    /* The last scanned row of this thumbnail row */
+    if (thumbnail->scannedRows ==
+	(long) (thumbnail->row + 1) * thumbnail->params.lines /
+	thumbnail->height)
+      finishRow (thumbnail);
+  }
+}
+
+int thumbnailWrite (Thumbnail *thumbnail, FILE *out)
+{
+  static const unsigned char signature[8] =
+    { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  int rowLength = 1 + thumbnail->width * thumbnail->channels;
+  long rawLength = (long) thumbnail->height * rowLength;
+  unsigned char header[13];
+  unsigned char *raw;
+  unsigned char *data;
+  unsigned long a = 1;
+  unsigned long b = 0;
+  long used;
+  long i;
+  int result;
+  int y;
+
+  /* The zlib header, the block and the Adler-32 */
+  raw = malloc (rawLength);
+  data = malloc (2 + rawLength * 11 / 8 + 8 + 4);
+
+  if (raw == NULL || data == NULL)
+  {
+    free (raw);
+    free (data);
+    return 0;
+  }
+
+  for (y = 0; y < thumbnail->height; y++)
+    filterRow (thumbnail, y, raw + (long) y * rowLength);
+
+  data[0] = 0x78;
+  data[1] = 0x01;
+  used = deflateFixed (raw, rawLength, data + 2);
+
+  if (used < 0)
+  {
+    free (raw);
+    free (data);
+    return 0;
+  }
+
+  used += 2;
+
+  for (i = 0; i < rawLength; i++)
+  {
+    a = (a + raw[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+
+  data[used++] = b >> 8;
+  data[used++] = b & 0xff;
+  data[used++] = a >> 8;
+  data[used++] = a & 0xff;
+
+  header[0] = thumbnail->width >> 24;
+  header[1] = thumbnail->width >> 16;
+  header[2] = thumbnail->width >> 8;
+  header[3] = thumbnail->width;
+  header[4] = thumbnail->height >> 24;
+  header[5] = thumbnail->height >> 16;
+  header[6] = thumbnail->height >> 8;
+  header[7] = thumbnail->height;
+  header[8] = 8;			/* Bits per sample */
+  header[9] = thumbnail->channels == 3 ? 2 : 0;	/* RGB or gray */
+  header[10] = 0;
+  header[11] = 0;
+  header[12] = 0;
+
+  result = fwrite (signature, 1, 8, out) == 8 &&
+    writeChunk (out, "IHDR", header, 13) &&
+    writeChunk (out, "IDAT", data, used) &&
+    writeChunk (out, "IEND", NULL, 0);
+
+  free (raw);
+  free (data);
+  return result;
+}
+
+void thumbnailDestroy (Thumbnail *thumbnail)
+{
+  free (thumbnail->columnEnd);
+  free (thumbnail->sums);
+  free (thumbnail->pixels);
+  free (thumbnail);
+}
+
+
+static int countWhite (const unsigned char *row, int first, int end)
+{
+  int count = 0;
+  int x = first;
+
+  /* Up to a whole byte */
+  for (; x < end && (x & 7) != 0; x++)
+    count += (row[x >> 3] >> (7 - (x & 7))) & 1;
+
+  /* Whole bytes */
+  for (; x + 8 <= end; x += 8)
+    count += __builtin_popcount (row[x >> 3]);
+
+  for (; x < end; x++)
+    count += (row[x >> 3] >> (7 - (x & 7))) & 1;
+
+  return count;
+}
+
+
+static void addRow (Thumbnail *thumbnail, const unsigned char *data)
+{
+  unsigned long *sums = thumbnail->sums;
+  int first = 0;
+  int column;
+  int x;
+
+  for (column = 0; column < thumbnail->width; column++)
+  {
+    int end = thumbnail->columnEnd[column];
+
+    if (thumbnail->channels == 3)
+    {
+      unsigned long red = 0;
+      unsigned long green = 0;
+      unsigned long blue = 0;
+
+      for (x = first; x < end; x++)
+      {
+	red += data[3 * x];
+	green += data[3 * x + 1];
+	blue += data[3 * x + 2];
+      }
+
+      sums[3 * column] += red;
+      sums[3 * column + 1] += green;
+      sums[3 * column + 2] += blue;
+    }
+    else
+    {
+      sums[column] += 255 * countWhite (data, first, end);
+    }
+
+    first = end;
+  }
+}
+
+
+static void finishRow (Thumbnail *thumbnail)
+{
+  unsigned char *pixel = thumbnail->pixels +
+    (long) thumbnail->row * thumbnail->width * thumbnail->channels;
+  int rows = thumbnail->scannedRows - thumbnail->rowStart;
+  int first = 0;
+  int column;
+  int i;
+
+  for (column = 0; column < thumbnail->width; column++)
+  {
+    unsigned long area = (unsigned long) rows *
+      (thumbnail->columnEnd[column] - first);
+
+    for (i = 0; i < thumbnail->channels; i++)
+    {
+      unsigned long *sum = &thumbnail->sums[column * thumbnail->channels + i];
+
+      *pixel++ = (*sum + area / 2) / area;
+      *sum = 0;
+    }
+
+    first = thumbnail->columnEnd[column];
+  }
+
+  thumbnail->rowStart = thumbnail->scannedRows;
+  thumbnail->row++;
+}
+
+
+static void filterRow (Thumbnail *thumbnail, int y, unsigned char *out)
+{
+  int channels = thumbnail->channels;
+  int bytes = thumbnail->width * channels;
+  const unsigned char *row = thumbnail->pixels + (long) y * bytes;
+  const unsigned char *above = (y > 0) ? row - bytes : NULL;
+  unsigned long cost[3] = { 0, 0, 0 };
+  int type = 0;
+  int i;
+
+  /* The differences summed as signed bytes, as the PNG book suggests */
+  for (i = 0; i < bytes; i++)
+  {
+    int left = (i >= channels) ? row[i - channels] : 0;
+    int up = (above != NULL) ? above[i] : 0;
+
+    cost[0] += abs ((signed char) row[i]);
+    cost[1] += abs ((signed char) (row[i] - left));
+    cost[2] += abs ((signed char) (row[i] - up));
+  }
+
+  if (cost[1] < cost[type])
+    type = 1;
+
+  if (cost[2] < cost[type])
+    type = 2;
+
+  out[0] = type;
+
+  for (i = 0; i < bytes; i++)
+  {
+    if (type == 1)
+      out[i + 1] = row[i] - ((i >= channels) ? row[i - channels] : 0);
+    else if (type == 2)
+      out[i + 1] = row[i] - above[i];
+    else
+      out[i + 1] = row[i];
+  }
+}
+
+
+static long deflateFixed (const unsigned char *in, long length,
+			  unsigned char *out)
+{
+  BitWriter writer = { out, 0, 0, 0 };
+  long *head = malloc ((1 << DEFLATE_HASH_BITS) * sizeof (long));
+  long *previous = malloc (DEFLATE_WINDOW * sizeof (long));
+  long position = 0;
+
+  if (head == NULL || previous == NULL)
+  {
+    free (head);
+    free (previous);
+    return -1;
+  }
+
+  /* Nothing has been seen yet */
+  memset (head, 0xff, (1 << DEFLATE_HASH_BITS) * sizeof (long));
+
+  /* The last block, with the fixed codes */
+  putBits (&writer, 1, 1);
+  putBits (&writer, 1, 2);
+
+  while (position < length)
+  {
+    long limit = length - position;
+    int best = 0;
+    int bestDistance = 0;
+    int step;
+
+    if (limit > DEFLATE_MAX_MATCH)
+      limit = DEFLATE_MAX_MATCH;
+
+    if (limit >= 3)
+    {
+      unsigned int hash = ((in[position] << 10) ^ (in[position + 1] << 5) ^
+			   in[position + 2]) & ((1 << DEFLATE_HASH_BITS) - 1);
+      long candidate = head[hash];
+      int tries = DEFLATE_CHAIN;
+
+      /* Older places are further down the chain */
+      while (candidate >= 0 && position - candidate <= DEFLATE_WINDOW &&
+	     tries-- > 0)
+      {
+	int match = 0;
+
+	while (match < limit && in[candidate + match] == in[position + match])
+	  match++;
+
+	if (match > best)
+	{
+	  best = match;
+	  bestDistance = position - candidate;
+
+	  if (match == limit)
+	    break;
+	}
+
+	candidate = previous[candidate & (DEFLATE_WINDOW - 1)];
+      }
+    }
+
+    if (best >= 3)
+      putMatch (&writer, best, bestDistance);
+    else
+    {
+      best = 1;
+      putSymbol (&writer, in[position]);
+    }
+
+    /* Every place passed over can start a later match */
+    for (step = 0; step < best; step++, position++)
+    {
+      unsigned int hash;
+
+      if (length - position < 3)
+	continue;
+
+      hash = ((in[position] << 10) ^ (in[position + 1] << 5) ^
+	      in[position + 2]) & ((1 << DEFLATE_HASH_BITS) - 1);
+      previous[position & (DEFLATE_WINDOW - 1)] = head[hash];
+      head[hash] = position;
+    }
+  }
+
+  /* End of block, then out to a whole byte */
+  putSymbol (&writer, 256);
+  putBits (&writer, 0, 7);
+
+  free (head);
+  free (previous);
+  return writer.used;
+}
+
+
+static void putBits (BitWriter *writer, unsigned long value, int count)
+{
+  writer->bits |= value << writer->count;
+  writer->count += count;
+
+  while (writer->count >= 8)
+  {
+    writer->out[writer->used++] = writer->bits & 0xff;
+    writer->bits >>= 8;
+    writer->count -= 8;
+  }
+}
+
+
+static void putCode (BitWriter *writer, unsigned int code, int length)
+{
+  unsigned int reversed = 0;
+  int i;
+
+  for (i = 0; i < length; i++)
+    reversed |= ((code >> i) & 1) << (length - 1 - i);
+
+  putBits (writer, reversed, length);
+}
+
+
+static void putSymbol (BitWriter *writer, int symbol)
+{
+  /* RFC 1951, 3.2.6 */
+  if (symbol < 144)
+    putCode (writer, 0x30 + symbol, 8);
+  else if (symbol < 256)
+    putCode (writer, 0x190 + symbol - 144, 9);
+  else if (symbol < 280)
+    putCode (writer, symbol - 256, 7);
+  else
+    putCode (writer, 0xc0 + symbol - 280, 8);
+}
+
+
+static void putMatch (BitWriter *writer, int length, int distance)
+{
+  int code;
+
+  for (code = 28; lengthBase[code] > length; code--)
+    ;
+
+  putSymbol (writer, 257 + code);
+  putBits (writer, length - lengthBase[code], lengthExtra[code]);
+
+  for (code = 29; distanceBase[code] > distance; code--)
+    ;
+
+  putCode (writer, code, 5);
+  putBits (writer, distance - distanceBase[code], distanceExtra[code]);
+}
+
+
+static void buildCrcTable (void)
+{
+  unsigned long c;
+  int i;
+  int k;
+
+  for (i = 0; i < 256; i++)
+  {
+    c = i;
+
+    for (k = 0; k < 8; k++)
+      c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+    crcTable[i] = c;
+  }
+}
+
+
+static int writeChunk (FILE *out, const char *type,
+		       const unsigned char *data, long length)
+{
+  unsigned char bytes[4];
+  unsigned long crc = 0xffffffff;
+  long i;
+
+  pthread_once (&crcBuilt, buildCrcTable);
+
+  for (i = 0; i < 4; i++)
+    crc = crcTable[(crc ^ (unsigned char) type[i]) & 0xff] ^ (crc >> 8);
+
+  for (i = 0; i < length; i++)
+    crc = crcTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+  crc ^= 0xffffffff;
+
+  bytes[0] = length >> 24;
+  bytes[1] = length >> 16;
+  bytes[2] = length >> 8;
+  bytes[3] = length;
+
+  if (fwrite (bytes, 1, 4, out) != 4 || fwrite (type, 1, 4, out) != 4 ||
+      (length > 0 && fwrite (data, 1, length, out) != (size_t) length))
+    return 0;
+
+  bytes[0] = crc >> 24;
+  bytes[1] = crc >> 16;
+  bytes[2] = crc >> 8;
+  bytes[3] = crc;
+
+  return fwrite (bytes, 1, 4, out) == 4;
+}
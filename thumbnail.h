@@ -0,0 +1,52 @@
+/*******************************************************************************
+ *  thumbnail.h
+ *
+ *  Purpose: A small preview of the page, made from the rows as they come
+ *           in, so a user interface need not decode the whole image to
+ *           show it.  Every pixel of the thumbnail is the mean of the box
+ *           of scanned pixels it covers; text comes out as gray.
+ *
+ *           Only one row of sums is kept between calls, so it costs no
+ *           more memory than the thumbnail itself.  It is written as a PNG
+ *           compressed with the fixed Huffman codes of deflate, each row
+ *           filtered by Sub or Up (nothing to link against), which keeps a
+ *           color thumbnail to about 13 kilobytes.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef THUMBNAIL_H
+#define THUMBNAIL_H
+
+#include "scanner.h"
+#include <stdio.h>
+
+#define THUMBNAIL_WIDTH 128
+
+typedef struct Thumbnail Thumbnail;
+
+
+
+
+/*******************************************************************************
+ *  thumbnailCreate() - A thumbnail width pixels wide of an image described
+ *                     by params, as high as keeps the aspect ratio.
+ *                     Returns NULL if there is not enough memory.
+ *
+ *  thumbnailRows() -  Adds the next rows of the image.
+ *
+ *  thumbnailWrite() - Writes the thumbnail as a PNG.  It can be written
+ *                     before the scan is over, for a preview that fills in
+ *                     as the scan goes on; the rows not scanned yet are
+ *                     white.  Returns 0 if it could not be written.
+ *
+ *  thumbnailDestroy() - Frees the thumbnail.
+ ******************************************************************************/
+Thumbnail *thumbnailCreate (ScanParameters *params, int width);
+void thumbnailRows (Thumbnail *thumbnail, const char *data, int rows);
+int thumbnailWrite (Thumbnail *thumbnail, FILE *out);
+void thumbnailDestroy (Thumbnail *thumbnail);
+
+#endif
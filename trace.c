@@ -0,0 +1,156 @@
+/*******************************************************************************
+ *  trace.c
+ *
+ *  Purpose: Writes Chrome trace-event JSON.  See trace.h.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "trace.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+
+
+/*******************************************************************************
+ *  traceFile -        Where the events go.  Every event is one line; the
+ *                     lock keeps lines from different threads apart.
+ *
+ *  threadId -         The calling thread's id, looked up once.
+ ******************************************************************************/
+int tracing = 0;
+
+static FILE *traceFile = NULL;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int threadId = 0;
+
+
+
+
+/*******************************************************************************
+ *  currentThread() -  The id the trace uses for the calling thread.
+ *
+ *  micros() -         A time in the microseconds the trace format uses.
+ ******************************************************************************/
+static int currentThread (void);
+static double micros (struct timespec *time);
+
+
+
+
+void traceOpen (const char *path)
+{
+  if (path == NULL || path[0] == '\0')
+    return;
+
+  traceFile = fopen (path, "w");
+
+  if (traceFile == NULL)
+  {
+    fprintf (stderr, "Could not write trace to %s\n", path);
+    return;
+  }
+
+  /* The JSON array format, which also loads if the closing ] is missing */
+  fprintf (traceFile, "[\n");
+  tracing = 1;
+  atexit (traceClose);
+
+  traceThreadName ("main");
+}
+
+void traceThreadName (const char *name)
+{
+  if (!tracing)
+    return;
+
+  pthread_mutex_lock (&traceLock);
+
+  /* It may have been closed since we looked */
+  if (traceFile != NULL)
+    fprintf (traceFile, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"
+	     "\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", (int) getpid (),
+	     currentThread (), name);
+  pthread_mutex_unlock (&traceLock);
+}
+
+void traceComplete (const char *category, const char *name,
+		    struct timespec *start, const char *args)
+{
+  struct timespec now;
+
+  if (!tracing)
+    return;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock (&traceLock);
+
+  if (traceFile != NULL)
+    fprintf (traceFile, "{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\","
+	     "\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+	     "\"args\":{%s}},\n", category, name, (int) getpid (),
+	     currentThread (), micros (start), micros (&now) - micros (start),
+	     args ? args : "");
+  pthread_mutex_unlock (&traceLock);
+}
+
+void traceNow (struct timespec *now)
+{
+  clock_gettime (CLOCK_MONOTONIC, now);
+}
+
+void traceFlush (void)
+{
+  if (!tracing)
+    return;
+
+  pthread_mutex_lock (&traceLock);
+
+  if (traceFile != NULL)
+    fflush (traceFile);
+  pthread_mutex_unlock (&traceLock);
+}
+
+void traceClose (void)
+{
+  if (!tracing)
+    return;
+
+  pthread_mutex_lock (&traceLock);
+  tracing = 0;
+
+  if (traceFile == NULL)
+  {
+    pthread_mutex_unlock (&traceLock);
+    return;
+  }
+
+  /* An empty metadata event so the last real one can keep its comma */
+  fprintf (traceFile, "{\"ph\":\"M\",\"name\":\"trace_end\",\"pid\":%d}\n]\n",
+	   (int) getpid ());
+  fclose (traceFile);
+  traceFile = NULL;
+  pthread_mutex_unlock (&traceLock);
+}
+
+
+static int currentThread (void)
+{
+  if (threadId == 0)
+    threadId = syscall (SYS_gettid);
+
+  return threadId;
+}
+
+
+static double micros (struct timespec *time)
+{
+  return time->tv_sec * 1000000.0 + time->tv_nsec / 1000.0;
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************
+ *  trace.h
+ *
+ *  Purpose: An opt-in timeline of a scan in Chrome trace-event JSON, so it
+ *           can be loaded into chrome://tracing or ui.perfetto.dev to see
+ *           where the time goes and whether USB, CPU and disk overlap.
+ *
+ *           PRIMASCAN_TRACE=<file> turns it on for primascan and
+ *           primascand.  Recorded are the phases of scannerStart(), every
+ *           USB transfer, poll loops, threads waiting on each other, and
+ *           output encoding, each on the thread that did it.
+ *
+ *           When it is off every trace point is a test of one variable.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <time.h>
+
+
+
+
+/*******************************************************************************
+ *  tracing -          Non-zero while a trace is being written.  Check it
+ *                     before reading the clock for a trace point.
+ ******************************************************************************/
+extern int tracing;
+
+
+
+
+/*******************************************************************************
+ *  traceOpen() -      Starts writing a trace to path, if it is not NULL or
+ *                     empty.  The trace is finished at exit.
+ *
+ *  traceThreadName() - Names the calling thread in the trace.
+ *
+ *  traceComplete() -  Records an event on the calling thread that started
+ *                     at start and ends now.  category and name are shown
+ *                     in the viewer; args, if not NULL, is the inside of a
+ *                     JSON object with more detail, e.g. "\"size\":64".
+ *
+ *  traceNow() -       Reads the clock for a trace point (CLOCK_MONOTONIC).
+ *
+ *  traceFlush() -     Pushes what has been recorded so far to the file.
+ *
+ *  traceClose() -     Finishes the trace.
+ ******************************************************************************/
+void traceOpen (const char *path);
+void traceThreadName (const char *name);
+void traceComplete (const char *category, const char *name,
+		    struct timespec *start, const char *args);
+void traceNow (struct timespec *now);
+void traceFlush (void);
+void traceClose (void);
+
+#endif
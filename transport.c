@@ -0,0 +1,52 @@
+/*******************************************************************************
+ *  transport.c
+ *
+ *  Purpose: Keeps the list of transports that were compiled in and picks
+ *           one by name.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "transport.h"
+#include <string.h>
+
+
+
+
+/*******************************************************************************
+ *  The first transport in the list is the default.
+ ******************************************************************************/
+static const Transport *transports[] = {
+#ifndef NO_LIBUSB
+  &usbTransport,
+#endif
+#ifdef HAVE_LIBUSB1
+  &usb1Transport,
+#endif
+#ifdef HAVE_USBFS
+  &usbfsTransport,
+#endif
+  &simTransport,
+  NULL
+};
+
+
+
+
+const Transport *findTransport (const char *name)
+{
+  int i;
+
+  if (name == NULL || *name == '\0')
+    return transports[0];
+
+  for (i = 0; transports[i] != NULL; i++)
+  {
+    if (!strcmp (transports[i]->name, name))
+      return transports[i];
+  }
+
+  return NULL;
+}
@@ -0,0 +1,132 @@
+/*******************************************************************************
+ *  transport.h
+ *
+ *  Purpose: The scanner engine never talks to libusb directly.  Every USB
+ *           operation goes through a Transport, which is a table of
+ *           functions that a particular backend fills in.  This lets the
+ *           same sequence tables run against a real Colorado 2400u or a
+ *           simulated one.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+
+
+
+/*******************************************************************************
+ *  Every function follows the libusb-0.1 conventions so the engine code
+ *  did not need to change when it moved behind this interface.  Transfers
+ *  return the number of bytes moved, or a negative value on error.
+ *
+ *  name -        Used to select a transport (PRIMASCAN_TRANSPORT=<name>)
+ *
+ *  init() -      Called once per process before anything else.
+ *
+ *  count() -     The number of Colorado 2400u scanners that are attached.
+ *
+ *  open() -      Opens and configures the scanner with the given index
+ *                (0 to count() - 1).  Returns NULL on failure.
+ *
+ *  close() -     Releases a scanner returned from open().
+ *
+ *  reset() -     Performs a USB port reset.  If that costs the transport
+ *                its handle (libusb-0.1 loses the device when it comes
+ *                back on the bus), it opens the scanner again behind the
+ *                same device pointer.  Returns a negative value if the
+ *                scanner could not be reset or opened again; it must still
+ *                be closed.
+ *
+ *  clearHalt() - Clears a stall on the given endpoint.
+ *
+ *  submitControl() - Queues a control transfer (the arguments are those of
+ *                controlMsg()) and returns as soon as it is on its way.
+ *                The data is copied, nothing is read back.  Returns 0, or
+ *                a negative value if it could not be queued.  Transfers
+ *                reach the device in the order they were queued.
+ *
+ *  flush() -     Waits until every queued transfer has finished.  Returns
+ *                0, or a negative value if any of them failed.
+ *
+ *  submitControl() and flush() are NULL for a transport that can only run
+ *  one transfer at a time.
+ *
+ *  allocBuffer() - Memory for bulk reads of up to size bytes that the
+ *                device can transfer into directly, without the kernel
+ *                copying it.  Returns NULL if there is none to be had.
+ *
+ *  freeBuffer() - Gives back a buffer from allocBuffer(), before the
+ *                device is closed.
+ *
+ *  allocBuffer() and freeBuffer() are NULL where there is no such memory.
+ ******************************************************************************/
+typedef struct Transport
+{
+  const char *name;
+
+  void (*init) (void);
+  int (*count) (void);
+  void *(*open) (int index);
+  void (*close) (void *device);
+  int (*reset) (void *device);
+  int (*clearHalt) (void *device, int ep);
+
+  int (*controlMsg) (void *device, int requestType, int request, int value,
+		     int index, char *buffer, int size, int timeout);
+  int (*bulkRead) (void *device, int ep, char *buffer, int size,
+		   int timeout);
+  int (*bulkWrite) (void *device, int ep, char *buffer, int size,
+		    int timeout);
+
+  int (*submitControl) (void *device, int requestType, int request,
+			int value, int index, char *buffer, int size,
+			int timeout);
+  int (*flush) (void *device);
+
+  char *(*allocBuffer) (void *device, int size);
+  void (*freeBuffer) (void *device, char *buffer, int size);
+} Transport;
+
+
+
+
+/*******************************************************************************
+ *  usbTransport -  libusb-0.1, the transport the driver has always used.
+ *                  Left out when built with NO_LIBUSB.
+ *
+ *  usb1Transport - libusb-1.0, which can queue control transfers, so the
+ *                  host controller always has the next ones at hand, and
+ *                  bulk reads go straight into usbfs memory where the
+ *                  kernel has it.  Only built with 'make LIBUSB1=1'.
+ *
+ *  usbfsTransport - Linux usbfs ioctls, with no library at all.  It queues
+ *                  and reads like usb1Transport.  Built on Linux.
+ *
+ *  simTransport -  A simulated Colorado 2400u.  Control transfers always
+ *                  succeed and IN requests return the response recorded in
+ *                  the sequence tables.  Bulk reads return a test pattern.
+ *                  PRIMASCAN_SIM_DEVICES sets how many are "attached".
+ *                  It queues control transfers like usb1Transport.
+ *
+ *  findTransport() - Returns the transport with the given name, or the
+ *                  default one if name is NULL.  Returns NULL if there is
+ *                  no transport by that name.
+ ******************************************************************************/
+#ifndef NO_LIBUSB
+extern const Transport usbTransport;
+#endif
+#ifdef HAVE_LIBUSB1
+extern const Transport usb1Transport;
+#endif
+#ifdef HAVE_USBFS
+extern const Transport usbfsTransport;
+#endif
+extern const Transport simTransport;
+
+const Transport *findTransport (const char *name);
+
+#endif
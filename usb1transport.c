@@ -0,0 +1,368 @@
+/*******************************************************************************
+ *  usb1transport.c
+ *
+ *  Purpose: The libusb-1.0 transport (PRIMASCAN_TRANSPORT=usb1).  It does
+ *           what usbtransport.c does, and can also queue control
+ *           transfers with libusb's asynchronous interface.  Scanner Setup
+ *           is mostly writes whose answer nobody waits for; with the next
+ *           ones already queued the host controller sends them back to
+ *           back instead of losing a frame or more between each.
+ *
+ *           Where the kernel supports it, the buffer bulk reads go into is
+ *           usbfs memory (libusb_dev_mem_alloc()), which the host
+ *           controller fills directly, so the image is not copied from the
+ *           kernel to us.
+ *
+ *           Every scanner gets a libusb context of its own, so the thread
+ *           driving it can handle its events without getting in the way
+ *           of the others in primascand.
+ *
+ *           'make LIBUSB1=1' builds it.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "transport.h"
+#include <libusb-1.0/libusb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* How many control transfers may be queued at once */
+#define USB1_QUEUE_DEPTH 8
+
+
+
+
+/*******************************************************************************
+ *  Usb1Device -   context -  The scanner's own libusb context
+ *                 handle -   The open scanner
+ *                 inFlight - Queued transfers that have not finished
+ *                 failed -   One of them failed since the last flush
+ ******************************************************************************/
+typedef struct Usb1Device
+{
+  libusb_context *context;
+  libusb_device_handle *handle;
+  int inFlight;
+  int failed;
+} Usb1Device;
+
+
+
+
+/*******************************************************************************
+ *  detectDevice() -   Finds the index'th Colorado 2400u in context.  If it
+ *                     is attached, it will return 1 and, unless device is
+ *                     NULL, store a reference to it in device.  If not, it
+ *                     will return 0.
+ *
+ *  transferDone() -   Called by libusb when a queued transfer finishes.
+ *
+ *  waitForQueue() -   Handles events until at most max transfers are
+ *                     queued.  Returns 0 if libusb failed.
+ ******************************************************************************/
+static int detectDevice (libusb_context *context, int index,
+			 libusb_device **device);
+static void LIBUSB_CALL transferDone (struct libusb_transfer *transfer);
+static int waitForQueue (Usb1Device *usb1, int max);
+
+
+
+
+static void usb1Init ()
+{
+  /* Contexts are made per scanner, the default one is only for counting */
+  libusb_init (NULL);
+}
+
+static int usb1Count ()
+{
+  int count = 0;
+
+  while (detectDevice (NULL, count, NULL))
+    count++;
+
+  return count;
+}
+
+static void *usb1Open (int index)
+{
+  Usb1Device *usb1 = calloc (1, sizeof (Usb1Device));
+  libusb_device *device;
+
+  if (usb1 == NULL)
+    return NULL;
+
+  if (libusb_init (&usb1->context) < 0)
+  {
+    free (usb1);
+    return NULL;
+  }
+
+  /* If the device is not attached */
+  if (!detectDevice (usb1->context, index, &device))
+  {
+    libusb_exit (usb1->context);
+    free (usb1);
+    return NULL;
+  }
+
+  /* Open device */
+  if (libusb_open (device, &usb1->handle) < 0)
+    usb1->handle = NULL;
+
+  libusb_unref_device (device);
+
+  /* Configure the Device */
+  if (usb1->handle == NULL ||
+      libusb_set_configuration (usb1->handle, 1) < 0 ||
+      libusb_claim_interface (usb1->handle, 0) < 0 ||
+      libusb_set_interface_alt_setting (usb1->handle, 0, 0) < 0)
+  {
+    if (usb1->handle != NULL)
+      libusb_close (usb1->handle);
+
+    libusb_exit (usb1->context);
+    free (usb1);
+    return NULL;
+  }
+
+  return usb1;
+}
+
+static void usb1Close (void *device)
+{
+  Usb1Device *usb1 = device;
+
+  /* Like the libusb-0.1 transport, leave the scanner reset */
+  waitForQueue (usb1, 0);
+  libusb_reset_device (usb1->handle);
+  libusb_release_interface (usb1->handle, 0);
+  libusb_close (usb1->handle);
+  libusb_exit (usb1->context);
+  free (usb1);
+}
+
+static int usb1Reset (void *device)
+{
+  Usb1Device *usb1 = device;
+
+  return libusb_reset_device (usb1->handle);
+}
+
+static int usb1ClearHalt (void *device, int ep)
+{
+  Usb1Device *usb1 = device;
+
+  return libusb_clear_halt (usb1->handle, ep);
+}
+
+static int usb1ControlMsg (void *device, int requestType, int request,
+			   int value, int index, char *buffer, int size,
+			   int timeout)
+{
+  Usb1Device *usb1 = device;
+
+  return libusb_control_transfer (usb1->handle, requestType, request, value,
+				  index, (unsigned char *) buffer, size,
+				  timeout);
+}
+
+static int usb1BulkRead (void *device, int ep, char *buffer, int size,
+			 int timeout)
+{
+  Usb1Device *usb1 = device;
+  int transferred = 0;
+  int result;
+
+  result = libusb_bulk_transfer (usb1->handle, ep, (unsigned char *) buffer,
+				 size, &transferred, timeout);
+
+  /* A short read is the caller's business, as with libusb-0.1 */
+  if (result < 0 && transferred == 0)
+    return result;
+
+  return transferred;
+}
+
+static int usb1BulkWrite (void *device, int ep, char *buffer, int size,
+			  int timeout)
+{
+  Usb1Device *usb1 = device;
+  int transferred = 0;
+  int result;
+
+  result = libusb_bulk_transfer (usb1->handle, ep, (unsigned char *) buffer,
+				 size, &transferred, timeout);
+
+  if (result < 0 && transferred == 0)
+    return result;
+
+  return transferred;
+}
+
+static int usb1SubmitControl (void *device, int requestType, int request,
+			      int value, int index, char *buffer, int size,
+			      int timeout)
+{
+  Usb1Device *usb1 = device;
+  struct libusb_transfer *transfer;
+  unsigned char *setup;
+  int result;
+
+  /* Make room in the queue first */
+  if (!waitForQueue (usb1, USB1_QUEUE_DEPTH - 1))
+    return -1;
+
+  transfer = libusb_alloc_transfer (0);
+  setup = malloc (LIBUSB_CONTROL_SETUP_SIZE + size);
+
+  if (transfer == NULL || setup == NULL)
+  {
+    libusb_free_transfer (transfer);
+    free (setup);
+    return -1;
+  }
+
+  libusb_fill_control_setup (setup, requestType, request, value, index,
+			     size);
+  memcpy (setup + LIBUSB_CONTROL_SETUP_SIZE, buffer, size);
+  libusb_fill_control_transfer (transfer, usb1->handle, setup, transferDone,
+				usb1, timeout);
+
+  /* libusb frees both once transferDone() has run */
+  transfer->flags =
+    LIBUSB_TRANSFER_FREE_BUFFER | LIBUSB_TRANSFER_FREE_TRANSFER;
+
+  result = libusb_submit_transfer (transfer);
+
+  if (result < 0)
+  {
+    libusb_free_transfer (transfer);
+    return result;
+  }
+
+  usb1->inFlight++;
+  return 0;
+}
+
+static char *usb1AllocBuffer (void *device, int size)
+{
+  /* NULL if the kernel or libusb can't, the engine falls back then */
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+  Usb1Device *usb1 = device;
+
+  return (char *) libusb_dev_mem_alloc (usb1->handle, size);
+#else
+  return NULL;
+#endif
+}
+
+static void usb1FreeBuffer (void *device, char *buffer, int size)
+{
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000105
+  Usb1Device *usb1 = device;
+
+  libusb_dev_mem_free (usb1->handle, (unsigned char *) buffer, size);
+#endif
+}
+
+static int usb1Flush (void *device)
+{
+  Usb1Device *usb1 = device;
+  int failed;
+
+  if (!waitForQueue (usb1, 0))
+    return -1;
+
+  failed = usb1->failed;
+  usb1->failed = 0;
+
+  return failed ? -1 : 0;
+}
+
+const Transport usb1Transport = {
+  "usb1",
+  usb1Init,
+  usb1Count,
+  usb1Open,
+  usb1Close,
+  usb1Reset,
+  usb1ClearHalt,
+  usb1ControlMsg,
+  usb1BulkRead,
+  usb1BulkWrite,
+  usb1SubmitControl,
+  usb1Flush,
+  usb1AllocBuffer,
+  usb1FreeBuffer
+};
+
+
+static int detectDevice (libusb_context *context, int index,
+			 libusb_device **device)
+{
+  struct libusb_device_descriptor descriptor;
+  libusb_device **list;
+  ssize_t count;
+  ssize_t i;
+  int found = 0;
+
+  count = libusb_get_device_list (context, &list);
+
+  if (count < 0)
+    return 0;
+
+  /* Match Colorado scanner to correct usb device. */
+  for (i = 0; i < count && !found; i++)
+  {
+    if (libusb_get_device_descriptor (list[i], &descriptor) < 0)
+      continue;
+
+    /* if Colorado 2400u is detected */
+    if (descriptor.idVendor == 0x0461 && descriptor.idProduct == 0x0346)
+    {
+      /* Skip the scanners before the one we want */
+      if (index-- > 0)
+	continue;
+
+      found = 1;
+
+      if (device != NULL)
+	*device = libusb_ref_device (list[i]);
+    }
+  }
+
+  libusb_free_device_list (list, 1);
+  return found;
+}
+
+
+static void LIBUSB_CALL transferDone (struct libusb_transfer *transfer)
+{
+  Usb1Device *usb1 = transfer->user_data;
+
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+    usb1->failed = 1;
+
+  usb1->inFlight--;
+}
+
+
+static int waitForQueue (Usb1Device *usb1, int max)
+{
+  /* Only this scanner's thread uses its context, so nobody else reaps */
+  while (usb1->inFlight > max)
+  {
+    if (libusb_handle_events (usb1->context) < 0)
+    {
+      usb1->failed = 1;
+      return 0;
+    }
+  }
+
+  return 1;
+}
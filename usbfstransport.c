@@ -0,0 +1,455 @@
+/*******************************************************************************
+ *  usbfstransport.c
+ *
+ *  Purpose: A transport that talks to the Linux kernel's usbfs
+ *           (/dev/bus/usb/BBB/DDD) itself, with no USB library in between
+ *           (PRIMASCAN_TRANSPORT=usbfs).  Built on Linux only.
+ *
+ *           Plain control transfers are one USBDEVFS_CONTROL ioctl each.
+ *           Bulk transfers and queued control transfers are URBs
+ *           (USBDEVFS_SUBMITURB), which live in the UsbfsDevice, so no
+ *           transfer allocates anything.  Whenever a URB is waited for,
+ *           every other one that has finished is reaped along with it.
+ *           Only the thread driving a scanner ever uses it, so there is
+ *           nothing to lock.
+ *
+ *           Bulk reads can go into usbfs memory (allocBuffer()), which the
+ *           host controller fills directly.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "transport.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/usb/ch9.h>
+#include <linux/usbdevice_fs.h>
+
+#define USBFS_PATH        "/dev/bus/usb"
+
+/* How many control transfers may be queued at once */
+#define USBFS_QUEUE_DEPTH 8
+
+/* The most a control transfer of the sequence tables carries */
+#define USBFS_CONTROL_MAX 64
+
+
+
+
+/*******************************************************************************
+ *  QueuedControl - A control URB and its setup packet and data.
+ *                 busy -     Submitted and not reaped yet
+ *
+ *  UsbfsDevice -  fd -       The usbfs node of the scanner
+ *                 queue -    The URBs for queued control transfers
+ *                 inFlight - How many of them are busy
+ *                 failed -   One of them failed since the last flush
+ *                 bulk -     The URB for bulk transfers
+ *                 bulkDone - bulk has been reaped
+ ******************************************************************************/
+typedef struct QueuedControl
+{
+  struct usbdevfs_urb urb;
+  unsigned char packet[sizeof (struct usb_ctrlrequest) + USBFS_CONTROL_MAX];
+  int busy;
+} QueuedControl;
+
+typedef struct UsbfsDevice
+{
+  int fd;
+  QueuedControl queue[USBFS_QUEUE_DEPTH];
+  int inFlight;
+  int failed;
+  struct usbdevfs_urb bulk;
+  int bulkDone;
+} UsbfsDevice;
+
+
+
+
+/*******************************************************************************
+ *  findDevice() -     Puts the path of the index'th Colorado 2400u in path.
+ *                     Returns 1 if it is attached, 0 if not.  Buses and
+ *                     devices are taken in the order of their numbers.
+ *
+ *  isScanner() -      Whether the usbfs node at path is a Colorado 2400u,
+ *                     going by its device descriptor.
+ *
+ *  reap() -           Reaps the URBs that have finished, waiting up to
+ *                     timeout ms (-1 for ever) for at least one.  Returns
+ *                     0 on a timeout or error.
+ *
+ *  bulkTransfer() -   Runs one bulk URB and waits for it.
+ ******************************************************************************/
+static int findDevice (int index, char *path, int size);
+static int isScanner (const char *path);
+static int reap (UsbfsDevice *usbfs, int timeout);
+static int bulkTransfer (UsbfsDevice *usbfs, int ep, char *buffer, int size,
+			 int timeout);
+
+
+
+
+static void usbfsInit ()
+{
+  /* Nothing to set up, every scanner is just a file */
+}
+
+static int usbfsCount ()
+{
+  char path[64];
+  int count = 0;
+
+  while (findDevice (count, path, sizeof (path)))
+    count++;
+
+  return count;
+}
+
+static void *usbfsOpen (int index)
+{
+  struct usbdevfs_setinterface setting = { 0, 0 };
+  unsigned int configuration = 1;
+  unsigned int interface = 0;
+  UsbfsDevice *usbfs;
+  char path[64];
+  int fd;
+
+  /* If the device is not attached */
+  if (!findDevice (index, path, sizeof (path)))
+    return NULL;
+
+  fd = open (path, O_RDWR | O_CLOEXEC);
+
+  if (fd < 0)
+    return NULL;
+
+  /* Configure the Device */
+  if (ioctl (fd, USBDEVFS_SETCONFIGURATION, &configuration) < 0 ||
+      ioctl (fd, USBDEVFS_CLAIMINTERFACE, &interface) < 0 ||
+      ioctl (fd, USBDEVFS_SETINTERFACE, &setting) < 0)
+  {
+    close (fd);
+    return NULL;
+  }
+
+  usbfs = calloc (1, sizeof (UsbfsDevice));
+
+  if (usbfs == NULL)
+  {
+    close (fd);
+    return NULL;
+  }
+
+  usbfs->fd = fd;
+  return usbfs;
+}
+
+static void usbfsClose (void *device)
+{
+  UsbfsDevice *usbfs = device;
+  unsigned int interface = 0;
+
+  /* Whatever is still queued is of no use to anybody */
+  while (usbfs->inFlight > 0 && reap (usbfs, 1000))
+    ;
+
+  /* Like the libusb-0.1 transport, leave the scanner reset */
+  ioctl (usbfs->fd, USBDEVFS_RESET, NULL);
+  ioctl (usbfs->fd, USBDEVFS_RELEASEINTERFACE, &interface);
+  close (usbfs->fd);
+  free (usbfs);
+}
+
+static int usbfsReset (void *device)
+{
+  UsbfsDevice *usbfs = device;
+
+  return ioctl (usbfs->fd, USBDEVFS_RESET, NULL);
+}
+
+static int usbfsClearHalt (void *device, int ep)
+{
+  UsbfsDevice *usbfs = device;
+  unsigned int endpoint = ep;
+
+  return ioctl (usbfs->fd, USBDEVFS_CLEAR_HALT, &endpoint);
+}
+
+static int usbfsControlMsg (void *device, int requestType, int request,
+			    int value, int index, char *buffer, int size,
+			    int timeout)
+{
+  UsbfsDevice *usbfs = device;
+  struct usbdevfs_ctrltransfer control;
+
+  control.bRequestType = requestType;
+  control.bRequest = request;
+  control.wValue = value;
+  control.wIndex = index;
+  control.wLength = size;
+  control.timeout = timeout;
+  control.data = buffer;
+
+  return ioctl (usbfs->fd, USBDEVFS_CONTROL, &control);
+}
+
+static int usbfsBulkRead (void *device, int ep, char *buffer, int size,
+			  int timeout)
+{
+  return bulkTransfer (device, ep | USB_DIR_IN, buffer, size, timeout);
+}
+
+static int usbfsBulkWrite (void *device, int ep, char *buffer, int size,
+			   int timeout)
+{
+  return bulkTransfer (device, ep & ~USB_DIR_IN, buffer, size, timeout);
+}
+
+static int usbfsSubmitControl (void *device, int requestType, int request,
+			       int value, int index, char *buffer, int size,
+			       int timeout)
+{
+  UsbfsDevice *usbfs = device;
+  struct usb_ctrlrequest *setup;
+  QueuedControl *queued = NULL;
+  int i;
+
+  if (size > USBFS_CONTROL_MAX)
+    return -1;
+
+  /* Make room in the queue first */
+  while (usbfs->inFlight == USBFS_QUEUE_DEPTH)
+  {
+    if (!reap (usbfs, timeout))
+      return -1;
+  }
+
+  for (i = 0; queued == NULL; i++)
+  {
+    if (!usbfs->queue[i].busy)
+      queued = &usbfs->queue[i];
+  }
+
+  setup = (struct usb_ctrlrequest *) queued->packet;
+  setup->bRequestType = requestType;
+  setup->bRequest = request;
+  setup->wValue = __cpu_to_le16 (value);
+  setup->wIndex = __cpu_to_le16 (index);
+  setup->wLength = __cpu_to_le16 (size);
+  memcpy (queued->packet + sizeof (struct usb_ctrlrequest), buffer, size);
+
+  memset (&queued->urb, 0, sizeof (queued->urb));
+  queued->urb.type = USBDEVFS_URB_TYPE_CONTROL;
+  queued->urb.endpoint = 0;
+  queued->urb.buffer = queued->packet;
+  queued->urb.buffer_length = sizeof (struct usb_ctrlrequest) + size;
+  queued->urb.usercontext = queued;
+
+  if (ioctl (usbfs->fd, USBDEVFS_SUBMITURB, &queued->urb) < 0)
+    return -errno;
+
+  queued->busy = 1;
+  usbfs->inFlight++;
+  return 0;
+}
+
+static int usbfsFlush (void *device)
+{
+  UsbfsDevice *usbfs = device;
+  int failed;
+
+  while (usbfs->inFlight > 0)
+  {
+    if (!reap (usbfs, 5000))
+    {
+      usbfs->failed = 1;
+      break;
+    }
+  }
+
+  failed = usbfs->failed;
+  usbfs->failed = 0;
+
+  return failed ? -1 : 0;
+}
+
+static char *usbfsAllocBuffer (void *device, int size)
+{
+  UsbfsDevice *usbfs = device;
+  void *buffer;
+
+  /* Only kernels with USBDEVFS_CAP_MMAP (4.6 and later) have it */
+  buffer = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, usbfs->fd,
+		 0);
+
+  return buffer == MAP_FAILED ? NULL : buffer;
+}
+
+static void usbfsFreeBuffer (void *device, char *buffer, int size)
+{
+  munmap (buffer, size);
+}
+
+const Transport usbfsTransport = {
+  "usbfs",
+  usbfsInit,
+  usbfsCount,
+  usbfsOpen,
+  usbfsClose,
+  usbfsReset,
+  usbfsClearHalt,
+  usbfsControlMsg,
+  usbfsBulkRead,
+  usbfsBulkWrite,
+  usbfsSubmitControl,
+  usbfsFlush,
+  usbfsAllocBuffer,
+  usbfsFreeBuffer
+};
+
+
+static int findDevice (int index, char *path, int size)
+{
+  struct dirent **buses;
+  struct dirent **devices;
+  char busPath[32];
+  int busCount;
+  int deviceCount;
+  int found = 0;
+  int i;
+  int j;
+
+  busCount = scandir (USBFS_PATH, &buses, NULL, alphasort);
+
+  if (busCount < 0)
+    return 0;
+
+  for (i = 0; i < busCount; i++)
+  {
+    /* Bus and device names are three digits, so they sort by number */
+    if (!found && buses[i]->d_name[0] != '.')
+    {
+      snprintf (busPath, sizeof (busPath), "%s/%.3s", USBFS_PATH,
+		buses[i]->d_name);
+      deviceCount = scandir (busPath, &devices, NULL, alphasort);
+
+      for (j = 0; j < deviceCount; j++)
+      {
+	if (!found && devices[j]->d_name[0] != '.')
+	{
+	  snprintf (path, size, "%s/%.3s", busPath, devices[j]->d_name);
+
+	  /* Skip the scanners before the one we want */
+	  if (isScanner (path) && index-- == 0)
+	    found = 1;
+	}
+
+	free (devices[j]);
+      }
+
+      if (deviceCount >= 0)
+	free (devices);
+    }
+
+    free (buses[i]);
+  }
+
+  free (buses);
+  return found;
+}
+
+
+static int isScanner (const char *path)
+{
+  struct usb_device_descriptor descriptor;
+  int fd = open (path, O_RDONLY | O_CLOEXEC);
+  int length;
+
+  if (fd < 0)
+    return 0;
+
+  /* Reading the node starts with the device descriptor */
+  length = read (fd, &descriptor, USB_DT_DEVICE_SIZE);
+  close (fd);
+
+  return length == USB_DT_DEVICE_SIZE &&
+    __le16_to_cpu (descriptor.idVendor) == 0x0461 &&
+    __le16_to_cpu (descriptor.idProduct) == 0x0346;
+}
+
+
+static int reap (UsbfsDevice *usbfs, int timeout)
+{
+  struct pollfd wait = { usbfs->fd, POLLOUT, 0 };
+  struct usbdevfs_urb *urb;
+  int reaped = 0;
+
+  if (poll (&wait, 1, timeout) <= 0 || (wait.revents & (POLLERR | POLLHUP)))
+    return 0;
+
+  /* Everything that is done, not just the first */
+  while (ioctl (usbfs->fd, USBDEVFS_REAPURBNDELAY, &urb) == 0)
+  {
+    reaped++;
+
+    if (urb == &usbfs->bulk)
+    {
+      usbfs->bulkDone = 1;
+      continue;
+    }
+
+    if (urb->status != 0)
+      usbfs->failed = 1;
+
+    ((QueuedControl *) urb->usercontext)->busy = 0;
+    usbfs->inFlight--;
+  }
+
+  return reaped > 0;
+}
+
+
+static int bulkTransfer (UsbfsDevice *usbfs, int ep, char *buffer, int size,
+			 int timeout)
+{
+  memset (&usbfs->bulk, 0, sizeof (usbfs->bulk));
+  usbfs->bulk.type = USBDEVFS_URB_TYPE_BULK;
+  usbfs->bulk.endpoint = ep;
+  usbfs->bulk.buffer = buffer;
+  usbfs->bulk.buffer_length = size;
+  usbfs->bulkDone = 0;
+
+  if (ioctl (usbfs->fd, USBDEVFS_SUBMITURB, &usbfs->bulk) < 0)
+    return -errno;
+
+  while (!usbfs->bulkDone)
+  {
+    if (!reap (usbfs, timeout))
+    {
+      /* Timed out, take it back; it is reaped once it has been */
+      ioctl (usbfs->fd, USBDEVFS_DISCARDURB, &usbfs->bulk);
+
+      while (!usbfs->bulkDone && reap (usbfs, 1000))
+	;
+
+      return -ETIMEDOUT;
+    }
+  }
+
+  /* A short transfer is the caller's business, as with libusb-0.1 */
+  if (usbfs->bulk.status != 0 && usbfs->bulk.actual_length == 0)
+    return usbfs->bulk.status;
+
+  return usbfs->bulk.actual_length;
+}
@@ -0,0 +1,267 @@
+/*******************************************************************************
+ *  usbtransport.c
+ *
+ *  Purpose: The libusb-0.1 transport.  This is the code that used to live
+ *           directly in sane_init(), sane_open() and the transfer functions
+ *           of primascan.c.
+ *
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+ ******************************************************************************/
+#include "transport.h"
+#include <usb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* How long a reset scanner gets to come back on the bus */
+#define REOPEN_TRIES    20
+#define REOPEN_DELAY_US 100000
+
+
+
+
+/*******************************************************************************
+ *  UsbDevice -        What open() returns.  A reset makes libusb-0.1 lose
+ *                     the device, so the handle is replaced by a new one
+ *                     and index says which scanner to look for.
+ ******************************************************************************/
+typedef struct UsbDevice
+{
+  usb_dev_handle *handle;
+  int index;
+} UsbDevice;
+
+/* libusb-0.1 keeps one bus list for everybody, and it is not thread safe */
+static pthread_mutex_t busLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+/*******************************************************************************
+ *  detectDevice() -   Finds the index'th Colorado 2400u on the bus.  If it
+ *                     is attached, it will return 1 and fill in device.
+ *                     If not, it will return 0.  Passing a NULL device
+ *                     just counts them.
+ *
+ *  openHandle() -     Looks at the bus again, then opens and configures the
+ *                     index'th scanner.  Returns NULL on failure.
+ ******************************************************************************/
+static int detectDevice (int index, struct usb_device *device);
+static usb_dev_handle *openHandle (int index);
+
+
+
+
+static void usbInit ()
+{
+  /* Initialize usb and find usb devices */
+  usb_init ();
+  usb_find_busses ();
+  usb_find_devices ();
+}
+
+static int usbCount ()
+{
+  int count = 0;
+
+  pthread_mutex_lock (&busLock);
+
+  while (detectDevice (count, NULL))
+    count++;
+
+  pthread_mutex_unlock (&busLock);
+  return count;
+}
+
+static void *usbOpen (int index)
+{
+  UsbDevice *usb;
+  usb_dev_handle *deviceHandle = openHandle (index);
+
+  if (deviceHandle == NULL)
+    return NULL;
+
+  usb = calloc (1, sizeof (UsbDevice));
+
+  if (usb == NULL)
+  {
+    usb_close (deviceHandle);
+    return NULL;
+  }
+
+  usb->handle = deviceHandle;
+  usb->index = index;
+
+  return usb;
+}
+
+static void usbClose (void *device)
+{
+  UsbDevice *usb = device;
+
+  /* Leave the scanner reset, as it always has been */
+  if (usb->handle != NULL)
+  {
+    usb_reset (usb->handle);
+    usb_close (usb->handle);
+  }
+
+  free (usb);
+}
+
+static int usbReset (void *device)
+{
+  UsbDevice *usb = device;
+  int tries;
+
+  /* The scanner comes back as a new device, the handle is of no more use */
+  if (usb->handle != NULL)
+  {
+    usb_reset (usb->handle);
+    usb_close (usb->handle);
+    usb->handle = NULL;
+  }
+
+  for (tries = 0; tries < REOPEN_TRIES && usb->handle == NULL; tries++)
+  {
+    usleep (REOPEN_DELAY_US);
+    usb->handle = openHandle (usb->index);
+  }
+
+  return (usb->handle != NULL) ? 0 : -1;
+}
+
+static int usbClearHalt (void *device, int ep)
+{
+  UsbDevice *usb = device;
+
+  return usb_clear_halt (usb->handle, ep);
+}
+
+static int usbControlMsg (void *device, int requestType, int request,
+			  int value, int index, char *buffer, int size,
+			  int timeout)
+{
+  UsbDevice *usb = device;
+
+  return usb_control_msg (usb->handle, requestType, request, value, index,
+			  buffer, size, timeout);
+}
+
+static int usbBulkRead (void *device, int ep, char *buffer, int size,
+			int timeout)
+{
+  UsbDevice *usb = device;
+
+  return usb_bulk_read (usb->handle, ep, buffer, size, timeout);
+}
+
+static int usbBulkWrite (void *device, int ep, char *buffer, int size,
+			 int timeout)
+{
+  UsbDevice *usb = device;
+
+  return usb_bulk_write (usb->handle, ep, buffer, size, timeout);
+}
+
+const Transport usbTransport = {
+  "usb",
+  usbInit,
+  usbCount,
+  usbOpen,
+  usbClose,
+  usbReset,
+  usbClearHalt,
+  usbControlMsg,
+  usbBulkRead,
+  usbBulkWrite,
+  NULL,
+  NULL,
+  NULL,
+  NULL
+};
+
+
+static int detectDevice (int index, struct usb_device *device)
+{
+  /* create variables */
+  u_int16_t idVendor = 0x0461;
+  u_int16_t idProduct = 0x0346;
+
+  struct usb_bus *busses;
+  struct usb_bus *bus;
+
+  busses = usb_get_busses ();
+
+  /* Match Colorado scanner to correct usb device. */
+  for (bus = busses; bus; bus = bus->next)
+  {
+    struct usb_device *dev;
+
+    for (dev = bus->devices; dev; dev = dev->next)
+    {
+
+      /* if Colorado 2400u is detected */
+      if ((dev->descriptor.idVendor == idVendor) &&
+	  (dev->descriptor.idProduct == idProduct))
+      {
+	/* Skip the scanners before the one we want */
+	if (index-- > 0)
+	  continue;
+
+	/* Yes, it was detected */
+	if (device != NULL)
+	  *device = *dev;
+
+	return 1;
+      }
+    }
+  }
+
+  /* if not detected */
+  return 0;
+}
+
+
+static usb_dev_handle *openHandle (int index)
+{
+  struct usb_device dev;
+  usb_dev_handle *deviceHandle = NULL;
+
+  /* The bus may have changed since usbInit(), not least after a reset */
+  pthread_mutex_lock (&busLock);
+  usb_find_busses ();
+  usb_find_devices ();
+
+  /* Open it while the list it came from is still in one piece */
+  if (detectDevice (index, &dev))
+    deviceHandle = usb_open (&dev);
+
+  pthread_mutex_unlock (&busLock);
+
+  /* If the device is not attached or could not be opened */
+  if (deviceHandle == NULL)
+    return NULL;
+
+  int status1;
+  int status2;
+  int status3;
+
+  /* Configure the Device */
+  status1 = usb_set_configuration (deviceHandle, 1);
+  status2 = usb_claim_interface (deviceHandle, 0);
+  status3 = usb_set_altinterface (deviceHandle, 0);
+
+  /* If any of the configuration fails */
+  if ((status1 < 0) || (status2 < 0) || (status3 < 0))
+  {
+    usb_close (deviceHandle);
+    return NULL;
+  }
+
+  return deviceHandle;
+}